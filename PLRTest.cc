@@ -4,9 +4,28 @@
 
 #include <gtest/gtest.h>
 #include "library.h"
+#include "parallel_plr.h"
+#include "optimal_plr.h"
+#include "gamma_tuner.h"
+#include "plr_arena.h"
+#include "compact_plr.h"
+#include "sampled_plr.h"
+#include "concurrent_plr.h"
+#include "block_plr.h"
+#include "transformed_plr.h"
+#include "string_plr.h"
+#include "spline_plr.h"
+#include "merge_plr.h"
+#include "compaction_plr.h"
+#include "sosd_loader.h"
+#include "build_service.h"
+#include "model_select.h"
 #include <vector>
 #include <string>
 #include <cmath>
+#include <random>
+#include <thread>
+#include <atomic>
 
 #include <fstream>
 
@@ -37,6 +56,28 @@ std::vector<Segment<uint64_t, double>> getFromRawString(const std::string &rawSt
     return segments;
 }
 
+// Generate sorted (key, block) points, keysPerBlock keys per block with normally distributed key jumps
+std::vector<Point<double>> generateKeyBlockPoints(size_t count, size_t keysPerBlock, double meanJump, unsigned seed) {
+    std::default_random_engine generator(seed);
+    std::normal_distribution<double> jump(meanJump, meanJump / 5);
+    std::vector<Point<double>> points;
+    double key = 1;
+    for (size_t i = 0; i < count; i++) {
+        points.emplace_back(key, static_cast<double>(i / keysPerBlock));
+        key += std::max(1.0, std::round(jump(generator)));
+    }
+    return points;
+}
+
+// Check every trained key is predicted within its error-bounded window
+void expectAllKeysInWindow(PLRDataRep<uint64_t, double> &rep, const std::vector<Point<double>> &points) {
+    for (auto pt: points) {
+        auto window = rep.GetValue(static_cast<uint64_t>(pt.x));
+        EXPECT_LE(window.first, pt.y) << "key " << pt.x;
+        EXPECT_GE(window.second, pt.y) << "key " << pt.x;
+    }
+}
+
 TEST(PointTest, PointRetrival) {
     auto s = Point<double>(0.5, 0.5);
     EXPECT_DOUBLE_EQ(0.5, s.x);
@@ -167,6 +208,1282 @@ TEST(StrToUint, testAllCharacter) {
     EXPECT_EQ(i, 2387225703656530209);
 }
 
+TEST(GreedyPLRTest, ErrorBoundInterpolate) {
+    auto points = generateKeyBlockPoints(5000, 10, 500, 1);
+    auto plr = GreedyPLR<uint64_t, double>(0.5);
+    for (auto pt: points) {
+        plr.process(pt);
+    }
+    auto rep = PLRDataRep<uint64_t, double>(0.5, plr.finish());
+    expectAllKeysInWindow(rep, points);
+}
+
+TEST(GreedyPLRTest, ErrorBoundClosedForm) {
+    auto points = generateKeyBlockPoints(5000, 10, 500, 2);
+    auto plr = GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+    for (auto pt: points) {
+        plr.process(pt);
+    }
+    auto rep = PLRDataRep<uint64_t, double>(0.5, plr.finish());
+    expectAllKeysInWindow(rep, points);
+}
+
+TEST(GreedyPLRTest, ClosedFormSplitsInsideGap) {
+    // A jump in y after a long gap forces a split between the two keys
+    auto plr = GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+    plr.process(Point<double>(0, 0));
+    plr.process(Point<double>(10, 1));
+    plr.process(Point<double>(20, 2));
+    plr.process(Point<double>(1020, 3));
+    auto segs = plr.finish();
+    ASSERT_EQ(segs.size(), 2);
+    EXPECT_EQ(segs[0].x_start, 0);
+    EXPECT_GT(segs[1].x_start, 20);
+    EXPECT_LT(segs[1].x_start, 1020);
+    // Keys inside the gap stay within gamma of the line between the two neighbouring keys
+    auto rep = PLRDataRep<uint64_t, double>(0.5, segs);
+    for (uint64_t key = 20; key <= 1020; key += 50) {
+        double expected = 2 + (key - 20) / 1000.0;
+        auto window = rep.GetValue(key);
+        EXPECT_LE(window.first, expected);
+        EXPECT_GE(window.second, floor(expected));
+    }
+}
+
+TEST(GreedyPLRTest, ClosedFormPointOnConeBoundary) {
+    // The third point lies exactly on the upper, then on the lower boundary of the cone set up by the first two
+    for (double end: {7.0, 1.0}) {
+        auto plr = GreedyPLR<uint64_t, double>(1, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+        plr.process(Point<double>(0, 4));
+        plr.process(Point<double>(4, 4));
+        plr.process(Point<double>(8, end));
+        auto segs = plr.finish();
+        EXPECT_EQ(segs.size(), 1);
+        // Keys inside the gap stay within gamma of the line between the two neighbouring keys
+        auto rep = PLRDataRep<uint64_t, double>(1, segs);
+        for (uint64_t key = 4; key <= 8; key++) {
+            double expected = 4 + (end - 4) * (key - 4) / 4.0;
+            auto window = rep.GetValue(key);
+            EXPECT_LE(window.first, expected) << "key " << key;
+            EXPECT_GE(window.second, floor(expected)) << "key " << key;
+        }
+    }
+}
+
+TEST(GreedyPLRTest, KeyZeroIsProcessed) {
+    auto plr = GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+    plr.process(Point<double>(0, 0));
+    auto segs = plr.finish();
+    ASSERT_EQ(segs.size(), 1);
+    EXPECT_EQ(segs[0].x_start, 0);
+}
+
+TEST(GreedyPLRTest, BulkTrainEquivalentToProcess) {
+    auto points = generateKeyBlockPoints(5000, 10, 500, 3);
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> blocks;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    for (auto mode: {GREEDY_PLR_GAP_MODE::INTERPOLATE, GREEDY_PLR_GAP_MODE::CLOSED_FORM}) {
+        auto plr = GreedyPLR<uint64_t, double>(0.5, mode);
+        for (auto pt: points) {
+            plr.process(pt);
+        }
+        auto expected = plr.finish();
+        auto bulk = GreedyPLR<uint64_t, double>(0.5, mode).train(keys.data(), blocks.data(), keys.size());
+        // Equivalent within rounding: the same bound and about the same number of segments
+        auto rep = PLRDataRep<uint64_t, double>(0.5, bulk);
+        expectAllKeysInWindow(rep, points);
+        EXPECT_LE(bulk.size(), expected.size() + expected.size() / 100 + 1);
+        EXPECT_GE(bulk.size() + bulk.size() / 100 + 1, expected.size());
+    }
+}
+
+TEST(GreedyPLRTest, BulkTrainImplicitRank) {
+    auto points = generateKeyBlockPoints(3000, 1, 100, 4);
+    std::vector<uint64_t> keys;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+    }
+    auto segs = GreedyPLR<uint64_t, double>(2, GREEDY_PLR_GAP_MODE::CLOSED_FORM).train(keys.data(), keys.size());
+    auto rep = PLRDataRep<uint64_t, double>(2, segs);
+    expectAllKeysInWindow(rep, points);
+}
+
+TEST(ParallelPLRTest, ErrorBoundAndSegmentCount) {
+    auto points = generateKeyBlockPoints(20000, 4, 300, 5);
+    std::vector<uint64_t> keys;
+    std::vector<double> blocks;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(pt.y);
+    }
+    auto serial = GreedyPLR<uint64_t, double>(2, GREEDY_PLR_GAP_MODE::CLOSED_FORM)
+            .train(keys.data(), blocks.data(), keys.size());
+    for (size_t threads: {1, 3, 8}) {
+        auto rep = ParallelPLR<uint64_t, double>(2, threads).train(keys.data(), blocks.data(), keys.size());
+        EXPECT_DOUBLE_EQ(rep.GetGamma(), 2);
+        EXPECT_LE(rep.GetSegs().size(), serial.size() + threads - 1);
+        expectAllKeysInWindow(rep, points);
+    }
+}
+
+TEST(ParallelPLRTest, SingleLineAcrossChunks) {
+    std::vector<uint64_t> keys;
+    for (uint64_t i = 0; i < 1000; i++) {
+        keys.push_back(i * 7);
+    }
+    auto rep = ParallelPLR<uint64_t, double>(1, 4).train(keys.data(), keys.size());
+    EXPECT_LE(rep.GetSegs().size(), 4);
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto window = rep.GetValue(keys[i]);
+        EXPECT_LE(window.first, i);
+        EXPECT_GE(window.second, i);
+    }
+}
+
+TEST(OptimalPLRTest, ErrorBoundAndFewerSegments) {
+    auto points = generateKeyBlockPoints(20000, 1, 300, 6);
+    for (double gamma: {0.5, 2.0, 8.0}) {
+        auto greedy = GreedyPLR<uint64_t, double>(gamma);
+        auto optimal = OptimalPLR<uint64_t, double>(gamma);
+        for (auto pt: points) {
+            greedy.process(pt);
+            optimal.process(pt);
+        }
+        auto greedySegs = greedy.finish();
+        auto optimalSegs = optimal.finish();
+        EXPECT_LE(optimalSegs.size(), greedySegs.size());
+        auto rep = PLRDataRep<uint64_t, double>(gamma, optimalSegs);
+        expectAllKeysInWindow(rep, points);
+    }
+}
+
+TEST(OptimalPLRTest, SinglePointAndLine) {
+    auto single = OptimalPLR<uint64_t, double>(0.5);
+    single.process(Point<double>(3, 1));
+    auto segs = single.finish();
+    ASSERT_EQ(segs.size(), 1);
+    EXPECT_TRUE((segs[0] == Segment<uint64_t, double>(3, 0, 1)));
+
+    auto line = OptimalPLR<uint64_t, double>(0.5);
+    for (int i = 0; i < 100; i++) {
+        line.process(Point<double>(i * 10, i));
+    }
+    EXPECT_EQ(line.finish().size(), 1);
+}
+
+TEST(GreedyPLRTest, StreamingSink) {
+    auto points = generateKeyBlockPoints(5000, 10, 500, 7);
+    auto plr = GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+    for (auto pt: points) {
+        plr.process(pt);
+    }
+    auto expected = plr.finish();
+
+    std::vector<Segment<uint64_t, double>> received;
+    std::stringstream encoded;
+    SegmentStreamWriter<uint64_t, double> writer(encoded, 0.5);
+    auto streaming = GreedyPLR<uint64_t, double>(0.5, [&](const Segment<uint64_t, double> &seg) {
+        received.push_back(seg);
+        writer(seg);
+    }, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+    for (auto pt: points) {
+        streaming.process(pt);
+    }
+    EXPECT_TRUE(streaming.finish().empty());
+
+    auto decoded = PLRDataRep<uint64_t, double>(encoded.str());
+    EXPECT_DOUBLE_EQ(decoded.GetGamma(), 0.5);
+    auto decodedSegs = decoded.GetSegs();
+    ASSERT_EQ(received.size(), expected.size());
+    ASSERT_EQ(decodedSegs.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_TRUE(expected[i] == received[i]) << "segment " << i;
+        EXPECT_TRUE(expected[i] == decodedSegs[i]) << "segment " << i;
+    }
+}
+
+TEST(GreedyPLRTest, StreamingSinkSegmentStart) {
+    auto points = generateKeyBlockPoints(5000, 10, 500, 7);
+    std::vector<uint64_t> keys;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+    }
+    auto transform = KeyTransform<uint64_t>::PiecewiseShift(keys.data(), keys.size(), 200);
+
+    std::stringstream encoded;
+    SegmentStreamWriter<uint64_t, double> writer(encoded, 0.5, SEGMENT_ORIGIN::SEGMENT_START, transform);
+    auto streaming = GreedyPLR<uint64_t, double>(0.5, std::ref(writer), GREEDY_PLR_GAP_MODE::CLOSED_FORM,
+                                                 SEGMENT_ORIGIN::SEGMENT_START);
+    auto plr = GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM, SEGMENT_ORIGIN::SEGMENT_START);
+    for (auto pt: points) {
+        streaming.process(transform(static_cast<uint64_t>(pt.x)), pt.y);
+        plr.process(transform(static_cast<uint64_t>(pt.x)), pt.y);
+    }
+    streaming.finish();
+    auto expected = plr.finish();
+
+    // The origin and the transform are read back from the stream header
+    auto decoded = PLRDataRep<uint64_t, double>(encoded.str());
+    EXPECT_DOUBLE_EQ(decoded.GetGamma(), 0.5);
+    EXPECT_EQ(decoded.GetSegmentOrigin(), SEGMENT_ORIGIN::SEGMENT_START);
+    EXPECT_EQ(decoded.GetKeyTransform().GetKind(), KEY_TRANSFORM::PIECEWISE_SHIFT_TRANSFORM);
+    EXPECT_EQ(decoded.GetSegs(), expected);
+    expectAllKeysInWindow(decoded, points);
+}
+
+TEST(GammaTunerTest, SegmentBudget) {
+    auto points = generateKeyBlockPoints(20000, 1, 300, 8);
+    std::vector<uint64_t> keys;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+    }
+    GammaBudget budget;
+    budget.max_segments = 50;
+    for (size_t threads: {1, 4}) {
+        auto result = GammaTuner<uint64_t, double>(budget, threads).tune(keys.data(), keys.size());
+        ASSERT_TRUE(result.feasible);
+        EXPECT_LE(result.best.segments, 50);
+        EXPECT_EQ(result.best.model_bytes, sizeof(double) + result.best.segments * sizeof(Segment<uint64_t, double>));
+        EXPECT_FALSE(result.evaluated.empty());
+        // A noticeably smaller gamma no longer fits
+        auto smaller = GreedyPLR<uint64_t, double>(result.best.gamma * 0.9, GREEDY_PLR_GAP_MODE::CLOSED_FORM)
+                .train(keys.data(), keys.size());
+        EXPECT_GT(smaller.size(), 50);
+    }
+}
+
+TEST(GammaTunerTest, WindowBudget) {
+    std::vector<uint64_t> keys;
+    for (uint64_t i = 0; i < 1000; i++) {
+        keys.push_back(i * i);
+    }
+    GammaBudget budget;
+    budget.max_window = 5;
+    budget.max_segments = 1;
+    auto result = GammaTuner<uint64_t, double>(budget).tune(keys.data(), keys.size());
+    EXPECT_FALSE(result.feasible);
+    EXPECT_LE(result.best.gamma, 2);
+
+    budget.max_segments = 1000;
+    result = GammaTuner<uint64_t, double>(budget).tune(keys.data(), keys.size());
+    EXPECT_TRUE(result.feasible);
+    EXPECT_LE(result.best.max_window, 5);
+
+    // No window is empty, only min_gamma is tried
+    budget.max_window = 0;
+    result = GammaTuner<uint64_t, double>(budget).tune(keys.data(), keys.size());
+    EXPECT_FALSE(result.feasible);
+    EXPECT_LE(result.best.gamma, 2);
+    EXPECT_EQ(result.evaluated.size(), 1);
+}
+
+TEST(GreedyPLRTest, SegmentStartExactForWideKeys) {
+    // Keys above 2^63 with gaps far below the double resolution at that magnitude (2048)
+    std::vector<uint64_t> keys;
+    std::vector<double> blocks;
+    uint64_t key = 0xF000000000000000ULL;
+    for (size_t i = 0; i < 20000; i++) {
+        keys.push_back(key);
+        blocks.push_back(static_cast<double>(i / 8));
+        key += 3 + (i * 7919) % 11;
+    }
+    auto perPoint = GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM, SEGMENT_ORIGIN::SEGMENT_START);
+    for (size_t i = 0; i < keys.size(); i++) {
+        perPoint.process(keys[i], blocks[i]);
+    }
+    auto expected = perPoint.finish();
+    auto bulk = GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM, SEGMENT_ORIGIN::SEGMENT_START)
+            .train(keys.data(), blocks.data(), keys.size());
+    ASSERT_EQ(expected.size(), bulk.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_TRUE(expected[i] == bulk[i]) << "segment " << i;
+    }
+
+    auto rep = PLRDataRep<uint64_t, double>(0.5, bulk, SEGMENT_ORIGIN::SEGMENT_START);
+    auto decoded = PLRDataRep<uint64_t, double>(rep.Encode());
+    EXPECT_EQ(decoded.GetSegmentOrigin(), SEGMENT_ORIGIN::SEGMENT_START);
+    EXPECT_DOUBLE_EQ(decoded.GetGamma(), 0.5);
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto window = decoded.GetValue(keys[i]);
+        EXPECT_LE(window.first, blocks[i]) << "key " << keys[i];
+        EXPECT_GE(window.second, blocks[i]) << "key " << keys[i];
+    }
+}
+
+TEST(PLRDataRepTest, LegacyEncodingForKeyZero) {
+    auto rep = PLRDataRep<uint64_t, double>(0.5);
+    rep.Add(Segment<uint64_t, double>(1, 2, 3));
+    auto encoded = rep.Encode();
+    EXPECT_EQ(encoded.size(), sizeof(double) + sizeof(Segment<uint64_t, double>));
+    EXPECT_DOUBLE_EQ(to_type<double>(encoded.substr(0, sizeof(double))), 0.5);
+    auto decoded = PLRDataRep<uint64_t, double>(encoded);
+    EXPECT_EQ(decoded.GetSegmentOrigin(), SEGMENT_ORIGIN::KEY_ZERO);
+}
+
+TEST(ConeKernelTest, KernelsAgree) {
+    std::default_random_engine generator(9);
+    std::uniform_real_distribution<double> noise(-0.2, 0.2);
+    std::vector<double> dx, dy;
+    for (int i = 1; i <= 103; i++) {
+        dx.push_back(i * 10);
+        dy.push_back(i + noise(generator));
+    }
+    dy[70] += 5; // Leaves the cone
+    double prevScalar = 0, lowerScalar = -1, upperScalar = 1;
+    auto scalar = coneScanScalar(dx.data(), dy.data(), dx.size(), 0.5, prevScalar, lowerScalar, upperScalar);
+    double prevAuto = 0, lowerAuto = -1, upperAuto = 1;
+    auto selected = coneScan(CONE_KERNEL::AUTO_KERNEL, dx.data(), dy.data(), dx.size(), 0.5, prevAuto, lowerAuto,
+                             upperAuto);
+    EXPECT_EQ(scalar, 70);
+    EXPECT_EQ(selected, scalar);
+    EXPECT_EQ(prevAuto, prevScalar);
+    EXPECT_EQ(lowerAuto, lowerScalar);
+    EXPECT_EQ(upperAuto, upperScalar);
+}
+
+TEST(ConeKernelTest, BulkTrainKernelsAgree) {
+    auto points = generateKeyBlockPoints(20000, 1, 300, 10);
+    std::vector<uint64_t> keys;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+    }
+    auto scalar = GreedyPLR<uint64_t, double>(4, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+    scalar.setConeKernel(CONE_KERNEL::SCALAR_KERNEL);
+    auto scalarSegs = scalar.train(keys.data(), keys.size());
+    auto selectedSegs = GreedyPLR<uint64_t, double>(4, GREEDY_PLR_GAP_MODE::CLOSED_FORM).train(keys.data(), keys.size());
+    ASSERT_EQ(scalarSegs.size(), selectedSegs.size());
+    for (size_t i = 0; i < scalarSegs.size(); i++) {
+        EXPECT_EQ(scalarSegs[i].x_start, selectedSegs[i].x_start);
+        EXPECT_EQ(scalarSegs[i].slope, selectedSegs[i].slope);
+        EXPECT_EQ(scalarSegs[i].y, selectedSegs[i].y);
+    }
+    auto rep = PLRDataRep<uint64_t, double>(4, selectedSegs);
+    expectAllKeysInWindow(rep, points);
+}
+
+TEST(PLRArenaTest, ReusableTrainerBuildsModelsInArena) {
+    PLRArena arena(4096);
+    ArenaAllocator<Segment<uint64_t, double>> alloc(arena);
+    ArenaGreedyPLR<uint64_t, double> trainer(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM, SEGMENT_ORIGIN::KEY_ZERO, alloc);
+    std::vector<ArenaPLRDataRep<uint64_t, double>> models;
+    std::vector<std::vector<Point<double>>> inputs;
+    for (unsigned seed = 0; seed < 20; seed++) {
+        inputs.push_back(generateKeyBlockPoints(500, 10, 500, 100 + seed));
+        trainer.reset();
+        for (auto pt: inputs.back()) {
+            trainer.process(pt);
+        }
+        models.emplace_back(0.5, trainer.finish());
+    }
+    EXPECT_GT(arena.BytesUsed(), 0);
+    for (size_t m = 0; m < models.size(); m++) {
+        auto plr = GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+        for (auto pt: inputs[m]) {
+            plr.process(pt);
+        }
+        auto expected = plr.finish();
+        auto &segs = models[m].GetSegs();
+        ASSERT_EQ(segs.size(), expected.size());
+        for (size_t i = 0; i < segs.size(); i++) {
+            EXPECT_TRUE(segs[i] == expected[i]);
+        }
+        for (auto pt: inputs[m]) {
+            auto window = models[m].GetValue(static_cast<uint64_t>(pt.x));
+            EXPECT_LE(window.first, pt.y);
+            EXPECT_GE(window.second, pt.y);
+        }
+    }
+}
+
+TEST(PLRArenaTest, ResetTrainerAllocatesExactModels) {
+    PLRArena arena(4096);
+    ArenaAllocator<Segment<uint64_t, double>> alloc(arena);
+    ArenaGreedyPLR<uint64_t, double> trainer(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM, SEGMENT_ORIGIN::KEY_ZERO, alloc);
+    // The first model grows the trainer buffer past the size of every later model
+    for (auto pt: generateKeyBlockPoints(5000, 10, 500, 120)) {
+        trainer.process(pt);
+    }
+    size_t largest = trainer.finish().size();
+    for (unsigned seed = 0; seed < 20; seed++) {
+        auto points = generateKeyBlockPoints(500, 10, 500, 121 + seed);
+        size_t before = arena.BytesUsed();
+        trainer.reset();
+        for (auto pt: points) {
+            trainer.process(pt);
+        }
+        ArenaPLRDataRep<uint64_t, double> model(0.5, trainer.finish());
+        ASSERT_LT(model.GetSegs().size(), largest);
+        EXPECT_EQ(arena.BytesUsed() - before, model.GetSegs().size() * sizeof(Segment<uint64_t, double>));
+    }
+}
+
+TEST(PLRArenaTest, ResetReusesChunks) {
+    PLRArena arena(1024);
+    arena.Allocate(1000, 8);
+    arena.Allocate(1000, 8);
+    auto reserved = arena.BytesReserved();
+    arena.Reset();
+    EXPECT_EQ(arena.BytesUsed(), 0);
+    arena.Allocate(1000, 8);
+    arena.Allocate(1000, 8);
+    EXPECT_EQ(arena.BytesReserved(), reserved);
+}
+
+TEST(CompactPLRTest, CompactWhenRoundingKeepsBound) {
+    auto points = generateKeyBlockPoints(20000, 16, 300, 11);
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> blocks;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x) + (1ULL << 40));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    // Leave room for rounding under the stored gamma
+    auto segs = GreedyPLR<uint64_t, double>(1.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM, SEGMENT_ORIGIN::SEGMENT_START)
+            .train(keys.data(), blocks.data(), keys.size());
+    auto model = PLRDataRep<uint64_t, double>(2, segs, SEGMENT_ORIGIN::SEGMENT_START);
+    auto compact = CompactPLRDataRep<uint64_t, double>(model, keys.data(), blocks.data(), keys.size());
+    ASSERT_TRUE(compact.IsCompact());
+    EXPECT_EQ(compact.SegmentBytes() * 2, model.GetSegs().size() * sizeof(Segment<uint64_t, double>));
+    auto decoded = CompactPLRDataRep<uint64_t, double>(compact.Encode());
+    EXPECT_TRUE(decoded.IsCompact());
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto window = decoded.GetValue(keys[i]);
+        EXPECT_LE(window.first, blocks[i]);
+        EXPECT_GE(window.second, blocks[i]);
+    }
+}
+
+TEST(CompactPLRTest, FallBackToWide) {
+    // Positions above 2^24 cannot be held by a float within gamma 0.5
+    std::vector<uint64_t> keys;
+    std::vector<double> positions;
+    for (uint64_t i = 0; i < 1000; i++) {
+        keys.push_back(i * 10);
+        positions.push_back(100000001.0 + i);
+    }
+    auto segs = GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM)
+            .train(keys.data(), positions.data(), keys.size());
+    auto model = PLRDataRep<uint64_t, double>(0.5, segs);
+    auto compact = CompactPLRDataRep<uint64_t, double>(model, keys.data(), positions.data(), keys.size());
+    EXPECT_FALSE(compact.IsCompact());
+    auto decoded = CompactPLRDataRep<uint64_t, double>(compact.Encode());
+    EXPECT_FALSE(decoded.IsCompact());
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto window = decoded.GetValue(keys[i]);
+        EXPECT_LE(window.first, positions[i]);
+        EXPECT_GE(window.second, positions[i]);
+    }
+
+    // A key range wider than 32 bits
+    auto wide = PLRDataRep<uint64_t, double>(0.5);
+    wide.Add(Segment<uint64_t, double>(0, 0, 0));
+    wide.Add(Segment<uint64_t, double>(1ULL << 33, 0, 1));
+    uint64_t wideKeys[] = {0, 1ULL << 33};
+    uint32_t wideBlocks[] = {0, 1};
+    EXPECT_FALSE((CompactPLRDataRep<uint64_t, double>(wide, wideKeys, wideBlocks, 2).IsCompact()));
+}
+
+TEST(SampledPLRTest, WidenedBoundCoversSkippedKeys) {
+    auto points = generateKeyBlockPoints(50000, 32, 200, 5);
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> blocks;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    for (auto mode: {SAMPLING_MODE::EVERY_KTH_KEY, SAMPLING_MODE::FIRST_KEY_PER_BLOCK}) {
+        auto result = SampledPLR<uint64_t, double>(1, 4, mode).train(keys.data(), blocks.data(), keys.size());
+        EXPECT_LT(result.sampled_keys, keys.size() / 4 + 2);
+        EXPECT_GE(result.model.GetGamma(), 1);
+        EXPECT_DOUBLE_EQ(result.gamma_loss, result.model.GetGamma() - 1);
+        EXPECT_EQ(result.gamma_loss > 0, result.max_error > 1);
+        for (size_t i = 0; i < keys.size(); i++) {
+            auto window = result.model.GetValue(keys[i]);
+            ASSERT_LE(window.first, blocks[i]);
+            ASSERT_GE(window.second, blocks[i]);
+        }
+    }
+
+    // Sampling every key is plain training
+    auto full = SampledPLR<uint64_t, double>(1, 1).train(keys.data(), blocks.data(), keys.size());
+    EXPECT_EQ(full.sampled_keys, keys.size());
+    EXPECT_DOUBLE_EQ(full.model.GetGamma(), 1);
+}
+
+TEST(GreedyPLRTest, ResumeFromEncodedState) {
+    auto points = generateKeyBlockPoints(20000, 8, 500, 13);
+    for (auto origin: {SEGMENT_ORIGIN::KEY_ZERO, SEGMENT_ORIGIN::SEGMENT_START}) {
+        GreedyPLR<uint64_t, double> full(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM, origin);
+        for (auto pt: points) {
+            full.process(static_cast<uint64_t>(pt.x), pt.y);
+        }
+        auto expected = full.finish();
+
+        // Checkpoint every 3000 points, keeping the closed segments next to the state
+        std::vector<Segment<uint64_t, double>> segs;
+        std::string state = GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM, origin).EncodeState();
+        for (size_t lo = 0; lo < points.size(); lo += 3000) {
+            GreedyPLR<uint64_t, double> resumed(state);
+            for (size_t i = lo; i < std::min(points.size(), lo + 3000); i++) {
+                resumed.process(static_cast<uint64_t>(points[i].x), points[i].y);
+            }
+            auto closed = resumed.takeSegments();
+            segs.insert(segs.end(), closed.begin(), closed.end());
+            state = resumed.EncodeState();
+        }
+        auto last = GreedyPLR<uint64_t, double>(state).finish();
+        segs.insert(segs.end(), last.begin(), last.end());
+        EXPECT_EQ(segs, expected);
+    }
+}
+
+TEST(ConcurrentPLRTest, LookupsWhileTraining) {
+    auto points = generateKeyBlockPoints(200000, 16, 300, 17);
+    GreedyPLR<uint64_t, double> plr(1, GREEDY_PLR_GAP_MODE::CLOSED_FORM, SEGMENT_ORIGIN::SEGMENT_START);
+    for (auto pt: points) {
+        plr.process(static_cast<uint64_t>(pt.x), pt.y);
+    }
+    auto expected = plr.finish();
+    // lastBefore[s] is the last point below the start of segment s, the segment closed when s is opened
+    std::vector<size_t> lastBefore(expected.size(), 0);
+    size_t p = 0;
+    for (size_t s = 1; s < expected.size(); s++) {
+        while (p + 1 < points.size() && static_cast<uint64_t>(points[p + 1].x) < expected[s].x_start) {
+            p++;
+        }
+        lastBefore[s] = p;
+    }
+
+    ConcurrentPLR<uint64_t, double> model(1, GREEDY_PLR_GAP_MODE::CLOSED_FORM, SEGMENT_ORIGIN::SEGMENT_START);
+    std::atomic<size_t> processed{0};
+    std::thread writer([&]() {
+        for (auto pt: points) {
+            model.process(static_cast<uint64_t>(pt.x), pt.y);
+            processed.store(processed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        model.finish();
+    });
+    // Every key processed before a lookup is in its window, whether the segment is closed or not
+    size_t misses = 0;
+    auto check = [&](size_t i) {
+        auto window = model.GetValue(static_cast<uint64_t>(points[i].x));
+        if (points[i].y < window.first || points[i].y > window.second) {
+            misses++;
+        }
+    };
+    std::default_random_engine generator(3);
+    while (processed.load(std::memory_order_acquire) < points.size()) {
+        size_t done = processed.load(std::memory_order_acquire);
+        if (done == 0) {
+            continue;
+        }
+        check(std::uniform_int_distribution<size_t>(0, done - 1)(generator));
+        // The last key of the segments being closed, where a stale segment count would miss them
+        size_t closed = model.GetSegmentCount();
+        for (size_t s = closed; s <= closed + 1 && s < expected.size(); s++) {
+            if (s > 0 && lastBefore[s] < done) {
+                check(lastBefore[s]);
+            }
+        }
+    }
+    writer.join();
+    EXPECT_EQ(misses, 0);
+
+    EXPECT_EQ(model.GetSegmentCount(), expected.size());
+    EXPECT_EQ(model.Snapshot().GetSegs(), expected);
+}
+
+// Check every key of every block [firstKeys[b], lastKeys[b]] is predicted within the window of block b
+template<typename M>
+void expectInteriorKeysInWindow(const M &model, const std::vector<uint64_t> &firstKeys,
+                                const std::vector<uint64_t> &lastKeys) {
+    for (size_t b = 0; b < firstKeys.size(); b++) {
+        for (uint64_t key = firstKeys[b]; key <= lastKeys[b]; key++) {
+            auto window = model.GetValue(key);
+            ASSERT_LE(window.first, b) << "key " << key;
+            ASSERT_GE(window.second, b) << "key " << key;
+        }
+    }
+}
+
+TEST(BlockBoundaryPLRTest, InteriorKeysInWindow) {
+    for (size_t keysPerBlock: {1, 7, 128}) {
+        auto points = generateKeyBlockPoints(20000, keysPerBlock, 300, 19);
+        std::vector<uint64_t> keys;
+        std::vector<uint32_t> blocks;
+        std::vector<uint64_t> firstKeys;
+        std::vector<uint64_t> lastKeys;
+        for (size_t i = 0; i < points.size(); i++) {
+            keys.push_back(static_cast<uint64_t>(points[i].x));
+            blocks.push_back(static_cast<uint32_t>(points[i].y));
+            if (i == 0 || points[i].y != points[i - 1].y) {
+                firstKeys.push_back(keys.back());
+                lastKeys.push_back(keys.back());
+            }
+            lastKeys.back() = keys.back();
+        }
+        BlockBoundaryPLR<uint64_t, double> builder(0.5, SEGMENT_ORIGIN::SEGMENT_START);
+        auto segs = builder.train(keys.data(), blocks.data(), keys.size());
+        EXPECT_LE(builder.GetBoundaryKeyCount(), 2 * firstKeys.size());
+        BlockBoundaryPLR<uint64_t, double> fromBoundaries(0.5, SEGMENT_ORIGIN::SEGMENT_START);
+        EXPECT_EQ(segs, fromBoundaries.trainBoundaries(firstKeys.data(), lastKeys.data(), firstKeys.size()));
+
+        auto model = PLRDataRep<uint64_t, double>(0.5, segs, SEGMENT_ORIGIN::SEGMENT_START);
+        expectAllKeysInWindow(model, points);
+        // Every key in the gaps inside a block, not only the generated ones
+        expectInteriorKeysInWindow(model, firstKeys, lastKeys);
+    }
+}
+
+// Dense sorted keys: jumps of 1 to 12, a few of them 40 times wider, and keysPerBlock drawn from 1 to 16
+// Block boundaries of such keys can land exactly on a cone edge.
+std::vector<uint64_t> generateDenseKeys(size_t count, unsigned seed, size_t &keysPerBlock) {
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<int> perBlock(1, 16);
+    std::uniform_int_distribution<int> jump(1, 12);
+    keysPerBlock = perBlock(generator);
+    std::vector<uint64_t> keys;
+    uint64_t key = 1;
+    for (size_t i = 0; i < count; i++) {
+        keys.push_back(key);
+        uint64_t step = jump(generator);
+        key += (generator() % 50 == 0) ? 40 * step : step;
+    }
+    return keys;
+}
+
+TEST(BlockBoundaryPLRTest, InteriorKeysInWindowDenseBlocks) {
+    for (unsigned seed = 0; seed < 32; seed++) {
+        size_t keysPerBlock;
+        auto keys = generateDenseKeys(3000, seed, keysPerBlock);
+        std::vector<uint64_t> firstKeys;
+        std::vector<uint64_t> lastKeys;
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (i % keysPerBlock == 0) {
+                firstKeys.push_back(keys[i]);
+                lastKeys.push_back(keys[i]);
+            }
+            lastKeys.back() = keys[i];
+        }
+        for (double gamma: {0.5, 1.0, 2.0, 4.0}) {
+            BlockBoundaryPLR<uint64_t, double> builder(gamma);
+            auto model = PLRDataRep<uint64_t, double>(
+                    gamma, builder.trainBoundaries(firstKeys.data(), lastKeys.data(), firstKeys.size()));
+            expectInteriorKeysInWindow(model, firstKeys, lastKeys);
+        }
+    }
+}
+
+// Skewed keys: bursts of dense keys separated by wide gaps, polynomial or exponential growth
+std::vector<uint64_t> generateSkewedKeys(size_t count, KEY_TRANSFORM shape, unsigned seed) {
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<uint64_t> gap(100000000, 1000000000);
+    std::vector<uint64_t> keys;
+    uint64_t key = 1000;
+    for (size_t i = 1; i <= count; i++) {
+        double x = static_cast<double>(i);
+        switch (shape) {
+            case KEY_TRANSFORM::PIECEWISE_SHIFT_TRANSFORM:
+                key += (i % 1000 == 0) ? gap(generator) : 1 + i % 3;
+                break;
+            case KEY_TRANSFORM::CDF_TRANSFORM:
+                key = static_cast<uint64_t>(x * x * x / 1000) + i;
+                break;
+            default:
+                key = static_cast<uint64_t>(std::pow(1.0002, x) * 1000) + i;
+        }
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+TEST(KeyTransformTest, Monotone) {
+    auto keys = generateSkewedKeys(20000, KEY_TRANSFORM::PIECEWISE_SHIFT_TRANSFORM, 23);
+    std::vector<KeyTransform<uint64_t>> transforms{
+            KeyTransform<uint64_t>::Log(),
+            KeyTransform<uint64_t>::PiecewiseShift(keys.data(), keys.size(), 8),
+            KeyTransform<uint64_t>::Cdf(keys.data(), keys.size(), 32)};
+    std::vector<uint64_t> probes;
+    std::default_random_engine generator(29);
+    std::uniform_int_distribution<uint64_t> probe(0, keys.back() + 1000);
+    for (size_t i = 0; i < 20000; i++) {
+        probes.push_back(probe(generator));
+    }
+    probes.insert(probes.end(), keys.begin(), keys.end());
+    probes.push_back(std::numeric_limits<uint64_t>::max());
+    std::sort(probes.begin(), probes.end());
+    for (auto &transform: transforms) {
+        for (size_t i = 1; i < probes.size(); i++) {
+            ASSERT_LE(transform(probes[i - 1]), transform(probes[i])) << transform.GetKind();
+        }
+    }
+    // Shifting only shrinks gaps, distinct keys stay distinct
+    for (size_t i = 1; i < keys.size(); i++) {
+        ASSERT_LT(transforms[1](keys[i - 1]), transforms[1](keys[i]));
+    }
+}
+
+TEST(TransformedPLRTest, FewerSegmentsOnSkewedKeys) {
+    for (auto shape: {KEY_TRANSFORM::LOG_TRANSFORM, KEY_TRANSFORM::PIECEWISE_SHIFT_TRANSFORM,
+                      KEY_TRANSFORM::CDF_TRANSFORM}) {
+        auto keys = generateSkewedKeys(100000, shape, 31);
+        KeyTransform<uint64_t> transform;
+        if (shape == KEY_TRANSFORM::LOG_TRANSFORM) {
+            transform = KeyTransform<uint64_t>::Log();
+        } else if (shape == KEY_TRANSFORM::PIECEWISE_SHIFT_TRANSFORM) {
+            transform = KeyTransform<uint64_t>::PiecewiseShift(keys.data(), keys.size(), 3);
+        } else {
+            transform = KeyTransform<uint64_t>::Cdf(keys.data(), keys.size(), 16);
+        }
+        auto plain = PLRDataRep<uint64_t, double>(
+                2, GreedyPLR<uint64_t, double>(2, GREEDY_PLR_GAP_MODE::CLOSED_FORM).train(keys.data(), keys.size()));
+        auto model = TransformedPLR<uint64_t, double>(2, transform).train(keys.data(), keys.size());
+        EXPECT_LT(model.GetSegs().size(), plain.GetSegs().size() / 2) << shape;
+        // Smaller even with the transform knots
+        auto encoded = model.Encode();
+        EXPECT_LT(encoded.size(), plain.Encode().size()) << shape;
+
+        auto decoded = PLRDataRep<uint64_t, double>(encoded);
+        EXPECT_EQ(decoded.GetKeyTransform().GetKind(), shape);
+        EXPECT_EQ(decoded.GetKeyTransform().GetKnots(), transform.GetKnots());
+        EXPECT_DOUBLE_EQ(decoded.GetGamma(), model.GetGamma());
+        for (size_t i = 0; i < keys.size(); i++) {
+            auto window = decoded.GetValue(keys[i]);
+            ASSERT_LE(window.first, i);
+            ASSERT_GE(window.second, i);
+        }
+    }
+}
+
+TEST(GreedyPLRTest, Keys128SharingPrefix) {
+    // 16-byte keys with the same first 8 bytes, which collapse to one 64-bit key
+    std::default_random_engine generator(41);
+    std::uniform_int_distribution<uint64_t> jump(1, 1000);
+    std::vector<unsigned __int128> keys;
+    std::vector<uint32_t> blocks;
+    uint64_t suffix = 0;
+    for (size_t i = 0; i < 20000; i++) {
+        suffix += jump(generator);
+        std::string str = "user0000";
+        for (int b = 7; b >= 0; b--) {
+            str.push_back(static_cast<char>((suffix >> (8 * b)) & 0xFF));
+        }
+        EXPECT_EQ(stringToNumber<uint64_t>(str), stringToNumber<uint64_t>("user0000"));
+        keys.push_back(stringToNumber<unsigned __int128>(str));
+        blocks.push_back(static_cast<uint32_t>(i / 16));
+    }
+    ASSERT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+
+    // Intercepts at key 0 of such keys lose the bound, KEY_ZERO is refused
+    ASSERT_DEATH((GreedyPLR<unsigned __int128, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM,
+                                                       SEGMENT_ORIGIN::KEY_ZERO)), "");
+    ASSERT_DEATH((PLRDataRep<unsigned __int128, double>(0.5, SEGMENT_ORIGIN::KEY_ZERO)), "");
+
+    // Wide keys train with SEGMENT_START unless told otherwise
+    auto segs = GreedyPLR<unsigned __int128, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM)
+            .train(keys.data(), blocks.data(), keys.size());
+    GreedyPLR<unsigned __int128, double> plr(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM, SEGMENT_ORIGIN::SEGMENT_START);
+    for (size_t i = 0; i < keys.size(); i++) {
+        plr.process(keys[i], blocks[i]);
+    }
+    EXPECT_EQ(plr.finish(), segs);
+
+    auto model = PLRDataRep<unsigned __int128, double>(0.5, segs);
+    EXPECT_EQ(model.GetSegmentOrigin(), SEGMENT_ORIGIN::SEGMENT_START);
+    auto decoded = PLRDataRep<unsigned __int128, double>(model.Encode());
+    EXPECT_EQ(decoded.GetSegs(), segs);
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto window = decoded.GetValue(keys[i]);
+        ASSERT_LE(window.first, blocks[i]);
+        ASSERT_GE(window.second, blocks[i]);
+    }
+}
+
+TEST(StringKeyPLRTest, CommonPrefixStripped) {
+    std::vector<std::string> keys;
+    std::vector<uint32_t> blocks;
+    for (size_t i = 0; i < 50000; i++) {
+        std::string number = std::to_string(1000000 + i * 7);
+        keys.push_back("user:" + std::string(12 - number.size(), '0') + number);
+        blocks.push_back(static_cast<uint32_t>(i / 32));
+    }
+    EXPECT_EQ(longestCommonPrefix(keys.data(), keys.size()), "user:000001");
+
+    auto model = StringKeyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM, SEGMENT_ORIGIN::SEGMENT_START)
+            .train(keys.data(), blocks.data(), keys.size());
+    EXPECT_EQ(model.GetKeyPrefix(), "user:000001");
+    EXPECT_DOUBLE_EQ(model.GetGamma(), 0.5);
+    // Without stripping, the first 8 bytes are the same for every key
+    auto unstripped = StringKeyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM,
+                                                     SEGMENT_ORIGIN::SEGMENT_START, false)
+            .train(keys.data(), blocks.data(), keys.size());
+    EXPECT_GT(unstripped.GetGamma(), 100);
+
+    auto decoded = PLRDataRep<uint64_t, double>(model.Encode());
+    EXPECT_EQ(decoded.GetKeyPrefix(), "user:000001");
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto window = decoded.GetValue(keys[i]);
+        ASSERT_LE(window.first, blocks[i]);
+        ASSERT_GE(window.second, blocks[i]);
+    }
+    // Keys without the prefix keep their order
+    EXPECT_EQ(decoded.GetValue(std::string("a")).first, 0);
+    EXPECT_GE(decoded.GetValue(std::string("zzz")).second, blocks.back());
+}
+
+TEST(GreedyPLRTest, MonotonePredictions) {
+    auto points = generateKeyBlockPoints(5000, 4, 300, 43);
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> blocks;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    for (auto origin: {SEGMENT_ORIGIN::KEY_ZERO, SEGMENT_ORIGIN::SEGMENT_START}) {
+        for (double gamma: {0.5, 2.0}) {
+            GreedyPLR<uint64_t, double> plr(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM, origin);
+            plr.setMonotone(true);
+            auto model = PLRDataRep<uint64_t, double>(gamma, plr.train(keys.data(), blocks.data(), keys.size()),
+                                                      origin);
+            expectAllKeysInWindow(model, points);
+            // Every key of the range, not only the trained ones
+            auto prev = model.GetValue(keys.front());
+            for (uint64_t key = keys.front(); key <= keys.back(); key++) {
+                auto window = model.GetValue(key);
+                ASSERT_LE(prev.first, window.first) << "key " << key;
+                ASSERT_LE(prev.second, window.second) << "key " << key;
+                prev = window;
+            }
+        }
+    }
+}
+
+TEST(SplinePLRTest, KnotsWithinBound) {
+    auto points = generateKeyBlockPoints(50000, 1, 300, 47);
+    for (uint64_t base: {0ULL, 1ULL << 60}) {
+        std::vector<uint64_t> keys;
+        for (auto pt: points) {
+            keys.push_back(base + static_cast<uint64_t>(pt.x));
+        }
+        for (double gamma: {0.5, 4.0, 32.0}) {
+            auto knots = GreedySpline<uint64_t, double>(gamma).train(keys.data(), keys.size());
+            EXPECT_EQ(knots.front().x, keys.front());
+            EXPECT_EQ(knots.back().x, keys.back());
+            auto model = SplinePLRDataRep<uint64_t, double>(SplinePLRDataRep<uint64_t, double>(gamma, knots).Encode());
+            EXPECT_EQ(model.GetKnots(), knots);
+            EXPECT_EQ(sizeof(Knot<uint64_t, double>), 16);
+            for (size_t i = 0; i < keys.size(); i++) {
+                auto window = model.GetValue(keys[i]);
+                ASSERT_LE(window.first, i) << "gamma " << gamma;
+                ASSERT_GE(window.second, i) << "gamma " << gamma;
+            }
+        }
+    }
+}
+
+TEST(PLRDataRepTest, CoarsenContainsOldWindows) {
+    auto points = generateKeyBlockPoints(10000, 8, 100, 53);
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> blocks;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    for (auto origin: {SEGMENT_ORIGIN::KEY_ZERO, SEGMENT_ORIGIN::SEGMENT_START}) {
+        auto model = PLRDataRep<uint64_t, double>(
+                0.5, GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM, origin)
+                        .train(keys.data(), blocks.data(), keys.size()), origin);
+        size_t segments = model.GetSegs().size();
+        for (double gamma: {1.0, 4.0, 16.0}) {
+            auto coarse = model.Coarsen(gamma);
+            EXPECT_DOUBLE_EQ(coarse.GetGamma(), gamma);
+            EXPECT_LE(coarse.GetSegs().size(), segments);
+            EXPECT_LT(coarse.GetSegs().size(), model.GetSegs().size());
+            segments = coarse.GetSegs().size();
+            for (uint64_t key = keys.front(); key <= keys.back(); key++) {
+                auto window = model.GetValue(key);
+                auto coarseWindow = coarse.GetValue(key);
+                ASSERT_LE(coarseWindow.first, window.first) << "key " << key;
+                ASSERT_GE(coarseWindow.second, window.second) << "key " << key;
+            }
+        }
+    }
+}
+
+TEST(ModelMergerTest, MergeOverlappingRuns) {
+    // Runs 0 and 1 share the lower keys, all three runs the middle ones and run 2 alone has the upper ones
+    auto points = generateKeyBlockPoints(20000, 1, 100, 59);
+    std::default_random_engine generator(59);
+    std::vector<uint64_t> runKeys[3];
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < points.size(); i++) {
+        size_t runs = (i < 6000) ? 2 : 3;
+        size_t run = (i < 14000) ? generator() % runs : 2;
+        runKeys[run].push_back(static_cast<uint64_t>(points[i].x));
+        keys.push_back(static_cast<uint64_t>(points[i].x));
+    }
+    const size_t KEYS_PER_BLOCK = 8;
+    std::vector<PLRDataRep<uint64_t, double>> models;
+    for (auto &run: runKeys) {
+        std::vector<uint32_t> blocks;
+        for (size_t i = 0; i < run.size(); i++) {
+            blocks.push_back(static_cast<uint32_t>(i / KEYS_PER_BLOCK));
+        }
+        models.emplace_back(0.5, GreedyPLR<uint64_t, double>(0.5, GREEDY_PLR_GAP_MODE::CLOSED_FORM)
+                .train(run.data(), blocks.data(), run.size()));
+    }
+    std::vector<ModelMergeInput<uint64_t, double>> inputs;
+    for (size_t j = 0; j < 3; j++) {
+        inputs.push_back({&models[j], runKeys[j].front(), runKeys[j].back(), runKeys[j].size(), KEYS_PER_BLOCK});
+    }
+    std::vector<uint32_t> blocks;
+    for (size_t i = 0; i < keys.size(); i++) {
+        blocks.push_back(static_cast<uint32_t>(i / KEYS_PER_BLOCK));
+    }
+
+    // Two overlapping runs fit in gamma 4, three do not
+    auto partial = ModelMerger<uint64_t, double>(4, KEYS_PER_BLOCK).merge(inputs, keys.data(), blocks.data(),
+                                                                          keys.size());
+    EXPECT_GT(partial.retrained_keys, 0);
+    EXPECT_LT(partial.retrained_keys, keys.size());
+    EXPECT_LT(partial.merge_bound, 4);
+    auto full = ModelMerger<uint64_t, double>(8, KEYS_PER_BLOCK).merge(inputs, keys.data(), blocks.data(),
+                                                                       keys.size());
+    EXPECT_EQ(full.retrained_keys, 0);
+    EXPECT_GT(full.merge_bound, 4);
+
+    for (auto *result: {&partial, &full}) {
+        size_t i = 0;
+        for (uint64_t key = keys.front(); key <= keys.back(); key++) {
+            while (i + 1 < keys.size() && keys[i + 1] <= key) {
+                i++;
+            }
+            auto window = result->model.GetValue(key);
+            ASSERT_LE(window.first, blocks[i]) << "key " << key;
+            ASSERT_GE(window.second, blocks[i]) << "key " << key;
+        }
+    }
+}
+
+TEST(CompactionPLRBuilderTest, TrainFromMerge) {
+    // Runs overlap, and keys shared by runs are only written once
+    auto points = generateKeyBlockPoints(20000, 1, 100, 61);
+    std::default_random_engine generator(61);
+    std::vector<uint64_t> runKeys[3];
+    for (auto pt: points) {
+        auto key = static_cast<uint64_t>(pt.x);
+        runKeys[generator() % 3].push_back(key);
+        if (generator() % 10 == 0) {
+            runKeys[generator() % 3].push_back(key);
+        }
+    }
+    std::vector<std::pair<const uint64_t *, size_t>> runs;
+    for (auto &run: runKeys) {
+        run.erase(std::unique(run.begin(), run.end()), run.end());
+        runs.emplace_back(run.data(), run.size());
+    }
+
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> blocks;
+    MergeIterator<uint64_t> merge(runs);
+    CompactionPLRBuilder<uint64_t, double> builder(1);
+    auto model = builder.build(merge, 8, [&](uint64_t key, size_t block) {
+        keys.push_back(key);
+        blocks.push_back(static_cast<uint32_t>(block));
+    });
+    ASSERT_EQ(keys.size(), points.size());
+    EXPECT_EQ(builder.GetKeyCount(), points.size());
+    EXPECT_EQ(builder.GetBlockCount(), (points.size() + 7) / 8);
+    for (size_t i = 0; i < keys.size(); i++) {
+        ASSERT_EQ(keys[i], static_cast<uint64_t>(points[i].x));
+    }
+    auto expected = BlockBoundaryPLR<uint64_t, double>(1).train(keys.data(), blocks.data(), keys.size());
+    EXPECT_EQ(model.GetSegs(), expected);
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto window = model.GetValue(keys[i]);
+        EXPECT_LE(window.first, blocks[i]) << "key " << keys[i];
+        EXPECT_GE(window.second, blocks[i]) << "key " << keys[i];
+    }
+
+    // Blocks cut by the writer, with any number of keys
+    CompactionPLRBuilder<uint64_t, double> cut(1);
+    std::vector<uint32_t> cutBlocks;
+    for (auto key: keys) {
+        cut.add(key);
+        cutBlocks.push_back(static_cast<uint32_t>(cut.GetBlockCount()));
+        if (generator() % 5 == 0) {
+            cut.endBlock();
+        }
+    }
+    expected = BlockBoundaryPLR<uint64_t, double>(1).train(keys.data(), cutBlocks.data(), keys.size());
+    EXPECT_EQ(cut.finish().GetSegs(), expected);
+}
+
+// Check every output key, and every key between two output keys of the same block, is predicted within the
+// window of its block
+void expectMergedKeysInWindow(const PLRDataRep<uint64_t, double> &model, const std::vector<uint64_t> &keys,
+                              const std::vector<size_t> &blocks) {
+    for (size_t i = 0; i < keys.size(); i++) {
+        uint64_t end = (i + 1 < keys.size() && blocks[i + 1] == blocks[i]) ? keys[i + 1] : keys[i] + 1;
+        for (uint64_t key = keys[i]; key < end; key++) {
+            auto window = model.GetValue(key);
+            ASSERT_LE(window.first, blocks[i]) << "key " << key;
+            ASSERT_GE(window.second, blocks[i]) << "key " << key;
+        }
+    }
+}
+
+TEST(CompactionPLRBuilderTest, EveryMergedKeyInWindow) {
+    for (unsigned seed = 0; seed < 32; seed++) {
+        size_t keysPerBlock;
+        auto merged = generateDenseKeys(3000, seed, keysPerBlock);
+        std::vector<uint64_t> runKeys[3];
+        for (size_t i = 0; i < merged.size(); i++) {
+            runKeys[i % 3].push_back(merged[i]);
+        }
+        std::vector<std::pair<const uint64_t *, size_t>> runs;
+        for (auto &run: runKeys) {
+            runs.emplace_back(run.data(), run.size());
+        }
+        for (double gamma: {0.5, 1.0, 2.0, 4.0}) {
+            std::vector<uint64_t> keys;
+            std::vector<size_t> blocks;
+            MergeIterator<uint64_t> merge(runs);
+            CompactionPLRBuilder<uint64_t, double> builder(gamma);
+            auto model = builder.build(merge, keysPerBlock, [&](uint64_t key, size_t block) {
+                keys.push_back(key);
+                blocks.push_back(block);
+            });
+            ASSERT_EQ(keys, merged);
+            expectMergedKeysInWindow(model, keys, blocks);
+
+            // Blocks cut by the writer, with any number of keys
+            std::default_random_engine generator(seed);
+            CompactionPLRBuilder<uint64_t, double> cut(gamma);
+            std::vector<size_t> cutBlocks;
+            for (auto key: keys) {
+                cut.add(key);
+                cutBlocks.push_back(cut.GetBlockCount());
+                if (generator() % 7 == 0) {
+                    cut.endBlock();
+                }
+            }
+            expectMergedKeysInWindow(cut.finish(), keys, cutBlocks);
+        }
+    }
+}
+
+TEST(MappedKeyFileTest, TrainFromSosdFile) {
+    auto points = generateKeyBlockPoints(50000, 1, 300, 67);
+    std::vector<uint64_t> keys;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        if (keys.size() % 1000 == 0) {
+            // Repeated keys keep the block of their first occurrence
+            keys.push_back(keys.back());
+        }
+    }
+    std::string path = testing::TempDir() + "plr_sosd_keys";
+    {
+        std::ofstream out(path, std::ios::binary);
+        uint64_t count = keys.size();
+        out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+        out.write(reinterpret_cast<const char *>(keys.data()), keys.size() * sizeof(uint64_t));
+    }
+
+    MappedKeyFile<uint64_t> file(path);
+    ASSERT_TRUE(file.IsOpen());
+    ASSERT_EQ(file.GetKeyCount(), keys.size());
+    EXPECT_EQ(file.GetKey(12345), keys[12345]);
+    GreedyPLR<uint64_t, double> plr(1, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+    auto segs = file.Train(plr, 16, 4096);
+
+    std::vector<uint64_t> unique;
+    std::vector<uint32_t> blocks;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (i == 0 || keys[i] != keys[i - 1]) {
+            unique.push_back(keys[i]);
+            blocks.push_back(static_cast<uint32_t>(i / 16));
+        }
+    }
+    auto expected = GreedyPLR<uint64_t, double>(1, GREEDY_PLR_GAP_MODE::CLOSED_FORM)
+            .train(unique.data(), blocks.data(), unique.size());
+    EXPECT_EQ(segs, expected);
+
+    // The key count does not match the file size
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        uint64_t count = keys.size() + 1;
+        out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+        out.write(reinterpret_cast<const char *>(keys.data()), keys.size() * sizeof(uint64_t));
+    }
+    EXPECT_FALSE(file.Open(path));
+    EXPECT_FALSE(file.IsOpen());
+    EXPECT_FALSE(file.Open(path + "_missing"));
+    std::remove(path.c_str());
+}
+
+TEST(PLRBuildServiceTest, PrioritiesAndCap) {
+    auto points = generateKeyBlockPoints(20000, 8, 100, 71);
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> blocks;
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    auto expected = GreedyPLR<uint64_t, double>(1, GREEDY_PLR_GAP_MODE::CLOSED_FORM)
+            .train(keys.data(), blocks.data(), keys.size());
+    std::atomic<int> running(0);
+    std::atomic<int> maxRunning(0);
+    std::mutex orderMutex;
+    std::vector<BUILD_PRIORITY> order;
+    auto source = [&](BUILD_PRIORITY priority) {
+        return [&, priority](GreedyPLR<uint64_t, double> &plr) {
+            int now = ++running;
+            int seen = maxRunning.load();
+            while (now > seen && !maxRunning.compare_exchange_weak(seen, now)) {}
+            {
+                std::lock_guard<std::mutex> lock(orderMutex);
+                order.push_back(priority);
+            }
+            for (size_t i = 0; i < keys.size(); i++) {
+                plr.process(keys[i], blocks[i]);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            running--;
+        };
+    };
+
+    std::vector<std::future<PLRDataRep<uint64_t, double>>> results;
+    {
+        // The gate build holds the only slot until all the builds are queued, then builds run one at a time,
+        // so they start in the order the service takes them off its queues
+        PLRBuildService<uint64_t, double> service(4, 1);
+        std::promise<void> started;
+        std::promise<void> gate;
+        auto opened = gate.get_future().share();
+        results.push_back(service.Submit(1, [&started, opened](GreedyPLR<uint64_t, double> &) {
+            started.set_value();
+            opened.wait();
+        }));
+        started.get_future().wait();
+        for (int i = 0; i < 6; i++) {
+            results.push_back(service.Submit(1, source(BUILD_PRIORITY::COMPACTION_BUILD)));
+        }
+        for (int i = 0; i < 6; i++) {
+            results.push_back(service.Submit(1, source(BUILD_PRIORITY::FLUSH_BUILD),
+                                             BUILD_PRIORITY::FLUSH_BUILD));
+        }
+        EXPECT_EQ(service.GetQueuedCount(), 12);
+        gate.set_value();
+    }
+    EXPECT_EQ(maxRunning.load(), 1);
+    ASSERT_EQ(order.size(), 12);
+    // Every flush build starts before the queued compaction builds
+    for (size_t i = 0; i < order.size(); i++) {
+        EXPECT_EQ(order[i], i < 6 ? BUILD_PRIORITY::FLUSH_BUILD : BUILD_PRIORITY::COMPACTION_BUILD) << i;
+    }
+    EXPECT_TRUE(results[0].get().GetSegs().empty());
+    for (size_t i = 1; i < 13; i++) {
+        EXPECT_EQ(results[i].get().GetSegs(), expected);
+    }
+
+    // A cap raised at run time, below the pool size
+    maxRunning = 0;
+    {
+        PLRBuildService<uint64_t, double> service(4, 1);
+        service.SetMaxConcurrentBuilds(2);
+        EXPECT_EQ(service.GetMaxConcurrentBuilds(), 2);
+        for (int i = 0; i < 8; i++) {
+            results.push_back(service.Submit(1, source(BUILD_PRIORITY::COMPACTION_BUILD)));
+        }
+    }
+    EXPECT_LE(maxRunning.load(), 2);
+    for (size_t i = 13; i < results.size(); i++) {
+        EXPECT_EQ(results[i].get().GetSegs(), expected);
+    }
+
+    // Source failures reach the caller
+    PLRBuildService<uint64_t, double> service(1);
+    auto failed = service.Submit(1, [](GreedyPLR<uint64_t, double> &) { throw std::runtime_error("no keys"); });
+    EXPECT_THROW(failed.get(), std::runtime_error);
+}
+
+// Check every key of a table is inside its window, before and after an encoding round trip
+void expectIndexCoversKeys(const BlockIndex<uint64_t, double> &index, const std::vector<uint64_t> &keys,
+                           const std::vector<uint32_t> &blocks) {
+    BlockIndex<uint64_t, double> decoded(index.Encode());
+    EXPECT_EQ(decoded.GetKind(), index.GetKind());
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto window = index.GetValue(keys[i]);
+        EXPECT_LE(window.first, blocks[i]) << "key " << keys[i];
+        EXPECT_GE(window.second, blocks[i]) << "key " << keys[i];
+        EXPECT_EQ(decoded.GetValue(keys[i]), window);
+    }
+}
+
+TEST(BlockIndexSelectorTest, CheapestIndex) {
+    BlockIndexSelector<uint64_t, double> selector;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> blocks;
+
+    // Uniform keys: a single segment
+    for (uint32_t i = 0; i < 10000; i++) {
+        keys.push_back(1000 + 64 * static_cast<uint64_t>(i));
+        blocks.push_back(i / 8);
+    }
+    auto uniform = selector.select(keys.data(), blocks.data(), keys.size());
+    EXPECT_EQ(uniform.candidates.size(), 5);
+    ASSERT_NE(uniform.index.GetKind(), BLOCK_INDEX::FENCE_POINTER_INDEX);
+    EXPECT_EQ(uniform.index.GetModel().GetSegs().size(), 1);
+    expectIndexCoversKeys(uniform.index, keys, blocks);
+
+    // Smooth keys: a PLR model
+    auto points = generateKeyBlockPoints(100000, 8, 100, 73);
+    keys.clear();
+    blocks.clear();
+    for (auto pt: points) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    auto smooth = selector.select(keys.data(), blocks.data(), keys.size());
+    EXPECT_EQ(smooth.index.GetKind(), BLOCK_INDEX::PLR_INDEX);
+    expectIndexCoversKeys(smooth.index, keys, blocks);
+
+    // Keys with heavy-tailed gaps, one per block: models need a segment every few keys
+    std::default_random_engine generator(73);
+    std::lognormal_distribution<double> gap(4, 3);
+    keys.clear();
+    blocks.clear();
+    uint64_t key = 1;
+    for (uint32_t i = 0; i < 20000; i++) {
+        keys.push_back(key);
+        blocks.push_back(i);
+        key += 1 + static_cast<uint64_t>(std::min(gap(generator), 1e12));
+    }
+    auto pathological = selector.select(keys.data(), blocks.data(), keys.size());
+    EXPECT_EQ(pathological.index.GetKind(), BLOCK_INDEX::FENCE_POINTER_INDEX);
+    // The most accurate PLR model is larger than the fence pointers
+    EXPECT_EQ(pathological.candidates[0].kind, BLOCK_INDEX::PLR_INDEX);
+    EXPECT_EQ(pathological.candidates[3].kind, BLOCK_INDEX::FENCE_POINTER_INDEX);
+    EXPECT_GT(pathological.candidates[0].bytes, pathological.candidates[3].bytes);
+    expectIndexCoversKeys(pathological.index, keys, blocks);
+
+    // Candidates are sized by their encoding
+    for (auto selection: {&uniform, &smooth, &pathological}) {
+        auto &candidates = selection->candidates;
+        auto cheapest = std::min_element(candidates.begin(), candidates.end(),
+                                         [](const BlockIndexCandidate<double> &a,
+                                            const BlockIndexCandidate<double> &b) { return a.cost < b.cost; });
+        EXPECT_EQ(cheapest->kind, selection->index.GetKind());
+        EXPECT_EQ(cheapest->bytes, selection->index.Encode().size());
+    }
+}
+
 int main() {
     ::testing::InitGoogleTest();
     return RUN_ALL_TESTS();
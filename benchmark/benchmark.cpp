@@ -0,0 +1,479 @@
+//
+// Training and lookup benchmarks for the PLR library
+//
+#include "../library.h"
+#include "../parallel_plr.h"
+#include "../optimal_plr.h"
+#include "../gamma_tuner.h"
+#include "../sampled_plr.h"
+#include "../block_plr.h"
+#include "../spline_plr.h"
+#include "../merge_plr.h"
+#include "../compaction_plr.h"
+#include "../sosd_loader.h"
+#include "../build_service.h"
+#include "../model_select.h"
+#include <vector>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+using namespace std;
+
+// Sorted (key, block) points with normally distributed key jumps
+vector<Point<double>> generateData(size_t count, size_t keys_per_block, double mean_jump, unsigned seed = 42) {
+    default_random_engine generator(seed);
+    normal_distribution<double> jump(mean_jump, mean_jump / 5);
+    vector<Point<double>> points;
+    points.reserve(count);
+    double key = 1;
+    for (size_t i = 0; i < count; i++) {
+        points.emplace_back(key, static_cast<double>(i / keys_per_block));
+        key += max(1.0, round(jump(generator)));
+    }
+    return points;
+}
+
+// Run fn once and return the elapsed time in milliseconds
+double timeMs(const function<void()> &fn) {
+    auto start = chrono::steady_clock::now();
+    fn();
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, milli>(end - start).count();
+}
+
+void printRow(const string &name, size_t keys, size_t segments, double ms) {
+    cout << left << setw(32) << name << right
+         << setw(12) << segments
+         << setw(12) << fixed << setprecision(2) << ms << " ms"
+         << setw(14) << setprecision(2) << keys / ms / 1000 << " Mkeys/s" << endl;
+}
+
+// INTERPOLATE vs CLOSED_FORM gap handling in GreedyPLR::process
+void benchGapMode(const vector<Point<double>> &data, double gamma) {
+    for (auto mode: {GREEDY_PLR_GAP_MODE::INTERPOLATE, GREEDY_PLR_GAP_MODE::CLOSED_FORM}) {
+        vector<Segment<uint64_t, double>> segs;
+        double ms = timeMs([&]() {
+            GreedyPLR<uint64_t, double> plr(gamma, mode);
+            for (auto pt: data) {
+                plr.process(pt);
+            }
+            segs = plr.finish();
+        });
+        printRow(mode == GREEDY_PLR_GAP_MODE::INTERPOLATE ? "GreedyPLR interpolate" : "GreedyPLR closed-form",
+                 data.size(), segs.size(), ms);
+    }
+}
+
+// Bulk train() over contiguous key/block arrays
+void benchBulk(const vector<Point<double>> &data, double gamma) {
+    vector<uint64_t> keys;
+    vector<uint32_t> blocks;
+    for (auto pt: data) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    vector<Segment<uint64_t, double>> segs;
+    double ms = timeMs([&]() {
+        segs = GreedyPLR<uint64_t, double>(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM)
+                .train(keys.data(), blocks.data(), keys.size());
+    });
+    printRow("GreedyPLR bulk train", data.size(), segs.size(), ms);
+}
+
+// ParallelPLR with an increasing number of threads
+void benchParallel(const vector<Point<double>> &data, double gamma) {
+    vector<uint64_t> keys;
+    vector<uint32_t> blocks;
+    for (auto pt: data) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    for (size_t threads: {1, 2, 4, 8}) {
+        size_t segments = 0;
+        double ms = timeMs([&]() {
+            auto rep = ParallelPLR<uint64_t, double>(gamma, threads).train(keys.data(), blocks.data(), keys.size());
+            segments = rep.GetSegs().size();
+        });
+        printRow("ParallelPLR " + to_string(threads) + " threads", data.size(), segments, ms);
+    }
+}
+
+// GreedyPLR vs OptimalPLR, segment count and build time
+void benchOptimal(const vector<Point<double>> &data, double gamma) {
+    vector<Segment<uint64_t, double>> segs;
+    double ms = timeMs([&]() {
+        GreedyPLR<uint64_t, double> plr(gamma);
+        for (auto pt: data) {
+            plr.process(pt);
+        }
+        segs = plr.finish();
+    });
+    printRow("GreedyPLR gamma " + to_string(gamma), data.size(), segs.size(), ms);
+    ms = timeMs([&]() {
+        OptimalPLR<uint64_t, double> plr(gamma);
+        for (auto pt: data) {
+            plr.process(pt);
+        }
+        segs = plr.finish();
+    });
+    printRow("OptimalPLR gamma " + to_string(gamma), data.size(), segs.size(), ms);
+}
+
+// GammaTuner for a segment budget, with the size/accuracy tradeoff of every pass
+void benchGammaTuner(const vector<Point<double>> &data, size_t max_segments) {
+    vector<uint64_t> keys;
+    vector<uint32_t> blocks;
+    for (auto pt: data) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    GammaBudget budget;
+    budget.max_segments = max_segments;
+    GammaTuneResult<double> result{};
+    double ms = timeMs([&]() {
+        result = GammaTuner<uint64_t, double>(budget, 4).tune(keys.data(), blocks.data(), keys.size());
+    });
+    cout << "GammaTuner budget " << max_segments << " segments: gamma " << result.best.gamma
+         << ", " << result.best.segments << " segments, " << result.best.model_bytes << " bytes, window "
+         << result.best.max_window << " blocks, " << result.evaluated.size() << " passes in " << ms << " ms" << endl;
+    for (auto &t: result.evaluated) {
+        cout << "    gamma " << setw(12) << t.gamma << setw(10) << t.segments << " segments"
+             << setw(10) << t.model_bytes << " bytes" << setw(8) << t.max_window << " blocks" << endl;
+    }
+}
+
+// Bulk train() with the scalar and the runtime selected (AVX2 if supported) cone kernel
+void benchConeKernel(const vector<Point<double>> &data, double gamma) {
+    vector<uint64_t> keys;
+    vector<uint32_t> blocks;
+    for (auto pt: data) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    for (auto kernel: {CONE_KERNEL::SCALAR_KERNEL, CONE_KERNEL::AUTO_KERNEL}) {
+        vector<Segment<uint64_t, double>> segs;
+        double ms = timeMs([&]() {
+            GreedyPLR<uint64_t, double> plr(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+            plr.setConeKernel(kernel);
+            segs = plr.train(keys.data(), blocks.data(), keys.size());
+        });
+        printRow(kernel == CONE_KERNEL::SCALAR_KERNEL ? "Bulk train scalar kernel" : "Bulk train auto kernel",
+                 data.size(), segs.size(), ms);
+    }
+}
+
+// BlockBoundaryPLR, training on the first and last key of every block only
+void benchBlockBoundary(const vector<Point<double>> &data, double gamma) {
+    vector<uint64_t> keys;
+    vector<uint32_t> blocks;
+    for (auto pt: data) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    vector<Segment<uint64_t, double>> segs;
+    size_t boundary_keys = 0;
+    double ms = timeMs([&]() {
+        BlockBoundaryPLR<uint64_t, double> builder(gamma);
+        segs = builder.train(keys.data(), blocks.data(), keys.size());
+        boundary_keys = builder.GetBoundaryKeyCount();
+    });
+    printRow("Block boundaries", data.size(), segs.size(), ms);
+    cout << "    " << boundary_keys << " boundary keys trained" << endl;
+}
+
+// GreedySpline knots (16 bytes) vs GreedyPLR segments (24 bytes), and lookup time over all keys
+void benchSpline(const vector<Point<double>> &data, double gamma) {
+    vector<uint64_t> keys;
+    for (auto pt: data) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+    }
+    vector<Segment<uint64_t, double>> segs;
+    double ms = timeMs([&]() {
+        segs = GreedyPLR<uint64_t, double>(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM).train(keys.data(), keys.size());
+    });
+    printRow("Bulk train gamma " + to_string(gamma), data.size(), segs.size(), ms);
+    PLRDataRep<uint64_t, double> model(gamma, segs);
+    uint64_t sum = 0;
+    double lookup_ms = timeMs([&]() {
+        for (auto key: keys) {
+            sum += model.GetValue(key).first;
+        }
+    });
+    cout << "    " << segs.size() * sizeof(Segment<uint64_t, double>) << " bytes, lookups " << lookup_ms << " ms" << endl;
+
+    vector<Knot<uint64_t, double>> knots;
+    ms = timeMs([&]() {
+        knots = GreedySpline<uint64_t, double>(gamma).train(keys.data(), keys.size());
+    });
+    printRow("GreedySpline gamma " + to_string(gamma), data.size(), knots.size(), ms);
+    SplinePLRDataRep<uint64_t, double> spline(gamma, knots);
+    lookup_ms = timeMs([&]() {
+        for (auto key: keys) {
+            sum += spline.GetValue(key).first;
+        }
+    });
+    cout << "    " << knots.size() * sizeof(Knot<uint64_t, double>) << " bytes, lookups " << lookup_ms << " ms"
+         << (sum == 0 ? " " : "") << endl;
+}
+
+// SampledPLR at increasing sampling rates, with the gamma it had to be widened to
+void benchSampling(const vector<Point<double>> &data, double gamma) {
+    vector<uint64_t> keys;
+    vector<uint32_t> blocks;
+    for (auto pt: data) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    for (auto mode: {SAMPLING_MODE::EVERY_KTH_KEY, SAMPLING_MODE::FIRST_KEY_PER_BLOCK}) {
+        for (size_t rate: {1, 4, 16, 64}) {
+            SampledTrainResult<uint64_t, double> result{PLRDataRep<uint64_t, double>(gamma), 0, 0, 0};
+            double ms = timeMs([&]() {
+                result = SampledPLR<uint64_t, double>(gamma, rate, mode).train(keys.data(), blocks.data(), keys.size());
+            });
+            string name = (mode == SAMPLING_MODE::EVERY_KTH_KEY ? "Sampled every " : "Sampled block every ")
+                          + to_string(rate);
+            printRow(name, data.size(), result.model.GetSegs().size(), ms);
+            cout << "    " << result.sampled_keys << " keys sampled, gamma " << result.model.GetGamma()
+                 << " (+" << result.gamma_loss << ")" << endl;
+        }
+    }
+}
+
+// Coarsen a trained model step by step, and report the memory freed by each gamma step next to the
+// segment count of a model retrained from the keys at the same gamma
+void benchCoarsen(const vector<Point<double>> &data, const vector<double> &gammas) {
+    vector<uint64_t> keys;
+    for (auto pt: data) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+    }
+    PLRDataRep<uint64_t, double> model(gammas.front(), GreedyPLR<uint64_t, double>(gammas.front()).train(
+            keys.data(), keys.size()));
+    for (size_t i = 1; i < gammas.size(); i++) {
+        PLRDataRep<uint64_t, double> coarse(0);
+        double ms = timeMs([&]() {
+            coarse = model.Coarsen(gammas[i]);
+        });
+        printRow("Coarsen gamma " + to_string(gammas[i]), data.size(), coarse.GetSegs().size(), ms);
+        size_t retrained = GreedyPLR<uint64_t, double>(gammas[i]).train(keys.data(), keys.size()).size();
+        size_t freed = (model.GetSegs().size() - coarse.GetSegs().size()) * sizeof(Segment<uint64_t, double>);
+        cout << "    freed " << freed << " bytes, retrained from keys " << retrained << " segments" << endl;
+        model = std::move(coarse);
+    }
+}
+
+// Merge the models of interleaved runs into the model of their compaction output, against retraining it
+void benchMerge(const vector<Point<double>> &data, size_t runs, double gamma) {
+    const size_t KEYS_PER_BLOCK = 64;
+    vector<vector<uint64_t>> run_keys(runs);
+    vector<uint64_t> keys;
+    vector<uint32_t> blocks;
+    for (size_t i = 0; i < data.size(); i++) {
+        run_keys[(i * 7919) % runs].push_back(static_cast<uint64_t>(data[i].x));
+        keys.push_back(static_cast<uint64_t>(data[i].x));
+        blocks.push_back(static_cast<uint32_t>(i / KEYS_PER_BLOCK));
+    }
+    vector<PLRDataRep<uint64_t, double>> models;
+    for (auto &run: run_keys) {
+        vector<uint32_t> run_blocks;
+        for (size_t i = 0; i < run.size(); i++) {
+            run_blocks.push_back(static_cast<uint32_t>(i / KEYS_PER_BLOCK));
+        }
+        models.emplace_back(1, GreedyPLR<uint64_t, double>(1, GREEDY_PLR_GAP_MODE::CLOSED_FORM)
+                .train(run.data(), run_blocks.data(), run.size()));
+    }
+    vector<ModelMergeInput<uint64_t, double>> inputs;
+    for (size_t j = 0; j < runs; j++) {
+        inputs.push_back({&models[j], run_keys[j].front(), run_keys[j].back(), run_keys[j].size(),
+                          static_cast<double>(KEYS_PER_BLOCK)});
+    }
+
+    ModelMergeResult<uint64_t, double> merged{PLRDataRep<uint64_t, double>(0), 0, 0};
+    double ms = timeMs([&]() {
+        merged = ModelMerger<uint64_t, double>(gamma, KEYS_PER_BLOCK).merge(inputs, keys.data(), blocks.data(),
+                                                                           keys.size());
+    });
+    printRow("Merge " + to_string(runs) + " runs gamma " + to_string(gamma), data.size(),
+             merged.model.GetSegs().size(), ms);
+    size_t input_segments = 0;
+    for (auto &model: models) {
+        input_segments += model.GetSegs().size();
+    }
+    cout << "    " << input_segments << " input segments, merge bound " << merged.merge_bound << ", retrained " << merged.retrained_keys << " keys" << endl;
+    vector<Segment<uint64_t, double>> segs;
+    ms = timeMs([&]() {
+        segs = GreedyPLR<uint64_t, double>(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM).train(keys.data(), blocks.data(),
+                                                                                          keys.size());
+    });
+    printRow("Retrain gamma " + to_string(gamma), data.size(), segs.size(), ms);
+}
+
+// Train while merging runs, against merging into a buffer and training on it afterwards
+void benchCompaction(const vector<Point<double>> &data, size_t runs, double gamma) {
+    const size_t KEYS_PER_BLOCK = 64;
+    vector<vector<uint64_t>> run_keys(runs);
+    for (size_t i = 0; i < data.size(); i++) {
+        run_keys[(i * 7919) % runs].push_back(static_cast<uint64_t>(data[i].x));
+    }
+    vector<pair<const uint64_t *, size_t>> sources;
+    for (auto &run: run_keys) {
+        sources.emplace_back(run.data(), run.size());
+    }
+
+    size_t written = 0;
+    PLRDataRep<uint64_t, double> model(gamma);
+    double ms = timeMs([&]() {
+        MergeIterator<uint64_t> merge(sources);
+        model = CompactionPLRBuilder<uint64_t, double>(gamma).build(merge, KEYS_PER_BLOCK,
+                                                                    [&](uint64_t, size_t) { written++; });
+    });
+    printRow("Merge + pipelined build", written, model.GetSegs().size(), ms);
+
+    vector<Segment<uint64_t, double>> segs;
+    ms = timeMs([&]() {
+        vector<uint64_t> keys;
+        vector<uint32_t> blocks;
+        for (MergeIterator<uint64_t> merge(sources); merge.valid(); merge.next()) {
+            blocks.push_back(static_cast<uint32_t>(keys.size() / KEYS_PER_BLOCK));
+            keys.push_back(merge.key());
+        }
+        segs = GreedyPLR<uint64_t, double>(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM).train(keys.data(), blocks.data(),
+                                                                                          keys.size());
+    });
+    printRow("Merge, then train", written, segs.size(), ms);
+}
+
+// Train straight from a memory-mapped SOSD key file, one key per position
+void benchSosd(const string &path, double gamma) {
+    MappedKeyFile<uint64_t> file(path);
+    if (!file.IsOpen()) {
+        cout << "Cannot map " << path << endl;
+        return;
+    }
+    vector<Segment<uint64_t, double>> segs;
+    double ms = timeMs([&]() {
+        GreedyPLR<uint64_t, double> plr(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+        segs = file.Train(plr);
+    });
+    printRow("SOSD gamma " + to_string(gamma), file.GetKeyCount(), segs.size(), ms);
+}
+
+// Build the models of many tables on the build service, against building them one after another
+void benchBuildService(const vector<Point<double>> &data, size_t tables, double gamma) {
+    vector<uint64_t> keys;
+    vector<uint32_t> blocks;
+    for (auto pt: data) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    size_t per_table = keys.size() / tables;
+    auto source = [&](size_t t) {
+        return [&, t](GreedyPLR<uint64_t, double> &plr) {
+            for (size_t i = t * per_table; i < (t + 1) * per_table; i++) {
+                plr.process(keys[i], blocks[i]);
+            }
+        };
+    };
+
+    size_t segments = 0;
+    double ms = timeMs([&]() {
+        for (size_t t = 0; t < tables; t++) {
+            GreedyPLR<uint64_t, double> plr(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+            source(t)(plr);
+            segments += plr.finish().size();
+        }
+    });
+    printRow(to_string(tables) + " tables, caller thread", tables * per_table, segments, ms);
+
+    for (size_t cap: {2, 8}) {
+        segments = 0;
+        ms = timeMs([&]() {
+            PLRBuildService<uint64_t, double> service(8, cap);
+            vector<future<PLRDataRep<uint64_t, double>>> models;
+            for (size_t t = 0; t < tables; t++) {
+                models.push_back(service.Submit(gamma, source(t)));
+            }
+            for (auto &model: models) {
+                segments += model.get().GetSegs().size();
+            }
+        });
+        printRow(to_string(tables) + " tables, service cap " + to_string(cap), tables * per_table, segments, ms);
+    }
+}
+
+// Estimated costs of every index candidate, and the lookup time of the chosen one
+void benchSelection(const string &name, const vector<Point<double>> &data) {
+    vector<uint64_t> keys;
+    vector<uint32_t> blocks;
+    for (auto pt: data) {
+        keys.push_back(static_cast<uint64_t>(pt.x));
+        blocks.push_back(static_cast<uint32_t>(pt.y));
+    }
+    const char *kinds[] = {"PLR", "Fence pointers", "Line"};
+    BlockIndexSelection<uint64_t, double> selection{BlockIndex<uint64_t, double>(vector<uint64_t>()), {}};
+    double ms = timeMs([&]() {
+        selection = BlockIndexSelector<uint64_t, double>().select(keys.data(), blocks.data(), keys.size());
+    });
+    cout << name << ": " << kinds[selection.index.GetKind()] << " chosen in " << ms << " ms" << endl;
+    for (auto &candidate: selection.candidates) {
+        cout << "    " << left << setw(16) << kinds[candidate.kind] << right
+             << " gamma " << setw(10) << candidate.gamma
+             << setw(12) << candidate.bytes << " bytes"
+             << " lookup " << setw(8) << candidate.lookup_cost
+             << " cost " << setw(8) << candidate.cost << endl;
+    }
+    uint64_t sum = 0;
+    ms = timeMs([&]() {
+        for (auto key: keys) {
+            sum += selection.index.GetValue(key).first;
+        }
+    });
+    cout << "    lookups " << ms << " ms" << (sum == 0 ? " " : "") << endl;
+}
+
+// With a SOSD key file as argument, only the file is benchmarked
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        for (double gamma: {1.0, 8.0, 32.0}) {
+            benchSosd(argv[1], gamma);
+        }
+        return 0;
+    }
+    const size_t KEY_COUNT = 1000000;
+    const double GAMMA = 0.5;
+    auto data = generateData(KEY_COUNT, 64, 500);
+    cout << "Keys: " << KEY_COUNT << ", gamma: " << GAMMA << endl;
+    cout << left << setw(32) << "Trainer" << right << setw(12) << "Segments" << setw(15) << "Time"
+         << setw(22) << "Throughput" << endl;
+    benchGapMode(data, GAMMA);
+    benchBulk(data, GAMMA);
+    benchParallel(data, GAMMA);
+    benchBlockBoundary(data, GAMMA);
+    benchCompaction(data, 4, GAMMA);
+    benchBuildService(data, 16, GAMMA);
+    benchSampling(data, GAMMA);
+
+    // One key per block, so that segments are not cut at every block boundary
+    auto ranks = generateData(KEY_COUNT, 1, 500);
+    for (double gamma: {1.0, 8.0, 32.0}) {
+        benchOptimal(ranks, gamma);
+    }
+    for (double gamma: {8.0, 32.0}) {
+        benchConeKernel(ranks, gamma);
+    }
+    for (double gamma: {1.0, 8.0, 32.0}) {
+        benchSpline(ranks, gamma);
+    }
+    benchCoarsen(ranks, {1.0, 2.0, 4.0, 8.0, 16.0, 32.0});
+
+    for (size_t runs: {2, 4}) {
+        benchMerge(ranks, runs, 4.0 * runs);
+    }
+
+    benchSelection("64 keys per block", data);
+    benchSelection("1 key per block", ranks);
+
+    benchGammaTuner(data, 1000);
+    return 0;
+}
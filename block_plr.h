@@ -0,0 +1,86 @@
+#include <vector>
+#include <algorithm>
+#include "library.h"
+
+#ifndef PLR_BLOCK_PLR_H
+#define PLR_BLOCK_PLR_H
+
+// Block-boundary PLR training
+// With key -> block models, y is a step function: every key of a block has the same y. The builder only feeds
+// the first and the last key of each block to a CLOSED_FORM GreedyPLR. Closed-form gap handling keeps the line
+// between two consecutive points within gamma of every segment covering the gap, and inside a block that line is
+// the block itself, so every interior key stays within gamma without being processed.
+// The segments have the same format as GreedyPLR::finish(), and GetValue() holds for every key of every block.
+template<typename N, typename D>
+class BlockBoundaryPLR {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    BlockBoundaryPLR(D _gamma, SEGMENT_ORIGIN _segment_origin = defaultSegmentOrigin<N>())
+            : plr(_gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM, _segment_origin) {}
+
+    // Add the key range [first_key, last_key] of the next block
+    // REQUIRED: blocks are added in key order, the PLR Model is not at the finishing state
+    void addBlock(N first_key, N last_key, D block) {
+        plr.process(first_key, block);
+        if (last_key != first_key) {
+            plr.process(last_key, block);
+        }
+        boundary_keys += (last_key != first_key) ? 2 : 1;
+    }
+
+    // Finish the PLR Model
+    // REQUIRED: Has not been called finish()
+    std::vector<Segment<N, D>> finish() {
+        return plr.finish();
+    }
+
+    // Train over sorted keys in block order, the i-th key is in block blocks[i]
+    // The end of every block is found by exponential search, so interior keys are not read
+    // REQUIRED: keys are sorted, blocks are non-decreasing, no block has been added
+    template<typename P>
+    std::vector<Segment<N, D>> train(const N *keys, const P *blocks, size_t count) {
+        size_t first = 0;
+        while (first < count) {
+            size_t last = runEnd_(blocks, first, count) - 1;
+            addBlock(keys[first], keys[last], static_cast<D>(blocks[first]));
+            first = last + 1;
+        }
+        return finish();
+    }
+
+    // Train over blocks given by their first and last keys, the i-th block is block first_block + i
+    // REQUIRED: blocks are in key order, no block has been added
+    std::vector<Segment<N, D>> trainBoundaries(const N *first_keys, const N *last_keys, size_t count,
+                                               D first_block = 0) {
+        for (size_t i = 0; i < count; i++) {
+            addBlock(first_keys[i], last_keys[i], first_block + static_cast<D>(i));
+        }
+        return finish();
+    }
+
+    // Keys fed to the trainer so far
+    size_t GetBoundaryKeyCount() const {
+        return boundary_keys;
+    }
+
+private:
+    GreedyPLR<N, D> plr;
+    size_t boundary_keys = 0;
+
+    // The end of the run of blocks[first] starting at first
+    template<typename P>
+    static size_t runEnd_(const P *blocks, size_t first, size_t count) {
+        // Gallop until blocks[first + step] leaves the run, then search the last interval
+        size_t lo = first;
+        size_t step = 1;
+        while (first + step < count && blocks[first + step] == blocks[first]) {
+            lo = first + step;
+            step *= 2;
+        }
+        size_t hi = std::min(first + step, count);
+        return std::upper_bound(blocks + lo, blocks + hi, blocks[first]) - blocks;
+    }
+};
+
+#endif //PLR_BLOCK_PLR_H
@@ -0,0 +1,144 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "library.h"
+
+#ifndef PLR_BUILD_SERVICE_H
+#define PLR_BUILD_SERVICE_H
+
+// Priorities of background builds, smaller first
+enum BUILD_PRIORITY {
+    FLUSH_BUILD = 0, // models of flushed memtables, which block the next flush
+    COMPACTION_BUILD, // models of compaction outputs
+    BUILD_PRIORITY_COUNT
+};
+
+// Feeds every (key, position) of a table to the GreedyPLR, in key order
+template<typename N, typename D>
+using KeySource = std::function<void(GreedyPLR<N, D> &)>;
+
+// Background model builds on a fixed pool of worker threads
+// Submit() queues a build and returns the future model, so training never runs on the caller thread. Queued
+// builds start by priority, then in submission order, and at most GetMaxConcurrentBuilds() run at once, which
+// leaves the other cores to the foreground (the cap can be changed at any time). An exception thrown by a
+// source is stored in the future of its build.
+// The destructor waits for every queued build.
+template<typename N, typename D>
+class PLRBuildService {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    explicit PLRBuildService(size_t threads = std::thread::hardware_concurrency(), size_t max_concurrent_builds = 0)
+            : max_running(max_concurrent_builds == 0 ? std::max<size_t>(1, threads) : max_concurrent_builds) {
+        for (size_t i = 0; i < std::max<size_t>(1, threads); i++) {
+            workers.emplace_back([this]() { work_(); });
+        }
+    }
+
+    PLRBuildService(const PLRBuildService &) = delete;
+
+    PLRBuildService &operator=(const PLRBuildService &) = delete;
+
+    ~PLRBuildService() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto &worker: workers) {
+            worker.join();
+        }
+    }
+
+    // Queue the build of a model from source
+    std::future<PLRDataRep<N, D>> Submit(D gamma, KeySource<N, D> source,
+                                         BUILD_PRIORITY priority = BUILD_PRIORITY::COMPACTION_BUILD,
+                                         GREEDY_PLR_GAP_MODE gap_mode = GREEDY_PLR_GAP_MODE::CLOSED_FORM,
+                                         SEGMENT_ORIGIN segment_origin = defaultSegmentOrigin<N>()) {
+        std::packaged_task<PLRDataRep<N, D>()> build([gamma, source, gap_mode, segment_origin]() {
+            GreedyPLR<N, D> plr(gamma, gap_mode, segment_origin);
+            source(plr);
+            return PLRDataRep<N, D>(gamma, plr.finish(), segment_origin);
+        });
+        auto result = build.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queues[priority].push_back(std::move(build));
+        }
+        ready.notify_one();
+        return result;
+    }
+
+    // REQUIRED: builds >= 1
+    void SetMaxConcurrentBuilds(size_t builds) {
+        assert(builds >= 1);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            max_running = builds;
+        }
+        ready.notify_all();
+    }
+
+    size_t GetMaxConcurrentBuilds() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return max_running;
+    }
+
+    // Builds submitted and not started yet
+    size_t GetQueuedCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t queued = 0;
+        for (auto &queue: queues) {
+            queued += queue.size();
+        }
+        return queued;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::packaged_task<PLRDataRep<N, D>()>> queues[BUILD_PRIORITY::BUILD_PRIORITY_COUNT];
+    size_t max_running;
+    size_t running = 0;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    // The queue of the next build, nullptr if there is none
+    // REQUIRED: mutex is held
+    std::deque<std::packaged_task<PLRDataRep<N, D>()>> *next_() {
+        for (auto &queue: queues) {
+            if (!queue.empty()) {
+                return &queue;
+            }
+        }
+        return nullptr;
+    }
+
+    void work_() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            ready.wait(lock, [this]() { return (next_() != nullptr && running < max_running) ||
+                                               (stopping && next_() == nullptr); });
+            auto queue = next_();
+            if (queue == nullptr) {
+                return;
+            }
+            auto build = std::move(queue->front());
+            queue->pop_front();
+            running++;
+            lock.unlock();
+            build();
+            lock.lock();
+            running--;
+            // A slot is free, and the workers waiting to stop may be done
+            ready.notify_all();
+        }
+    }
+};
+
+#endif //PLR_BUILD_SERVICE_H
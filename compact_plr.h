@@ -0,0 +1,170 @@
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include "library.h"
+
+#ifndef PLR_COMPACT_PLR_H
+#define PLR_COMPACT_PLR_H
+
+// A 12-byte segment of a CompactPLRDataRep
+struct __attribute__((packed)) CompactSegment {
+    uint32_t x_offset; // x_start - base key of the model
+    float slope;
+    float y; // The prediction at x_start
+
+    CompactSegment() = default;
+
+    CompactSegment(uint32_t _x_offset, float _slope, float _y) : x_offset(_x_offset), slope(_slope), y(_y) {}
+};
+
+// A PLR model stored with CompactSegment (half the size of Segment<uint64_t, double>)
+// Segments are stored as 32-bit offsets from the first segment start (the base key) and float parameters,
+// anchored at their own start. The conversion is checked at build time: every training key must still be
+// inside its GetValue() window after rounding. If it is not, the key range does not fit in 32 bits, or the model
+// has a KeyTransform, the model keeps the wide PLRDataRep form, so the gamma guarantee always holds.
+template<typename N, typename D>
+class CompactPLRDataRep {
+public:
+    // Convert model, trained over the sorted keys and their positions (or block ids)
+    template<typename P, typename Alloc>
+    CompactPLRDataRep(const PLRDataRep<N, D, Alloc> &model, const N *keys, const P *positions, size_t count)
+            : gamma_(model.GetGamma()), base_(0), wide_(model.GetGamma()) {
+        const auto &segs = model.GetSegs();
+        compact_ = !segs.empty() && model.GetKeyTransform().IsIdentity() && toCompact_(model) &&
+                   verify_(keys, positions, count);
+        if (!compact_) {
+            compact_segments_.clear();
+            wide_ = PLRDataRep<N, D>(gamma_, std::vector<Segment<N, D>>(segs.begin(), segs.end()),
+                                     model.GetSegmentOrigin());
+            wide_.SetKeyTransform(model.GetKeyTransform());
+        }
+    }
+
+    // REQUIRED: String must be encoded from Encode() function.
+    CompactPLRDataRep(const std::string &encoded_str) : gamma_(0), base_(0), wide_(0) {
+        Decode(encoded_str);
+    }
+
+    // Encoding: uint8_t 1, gamma, base key, then every segment as x_offset, slope, y
+    // or uint8_t 0 followed by PLRDataRep::Encode() for the wide form
+    std::string Encode() const {
+        std::stringstream ss;
+        ss << to_string<uint8_t>(compact_ ? 1 : 0);
+        if (!compact_) {
+            PLRDataRep<N, D> wide = wide_;
+            ss << wide.Encode();
+            return ss.str();
+        }
+        ss << to_string<D>(gamma_);
+        ss << to_string<N>(base_);
+        for (auto &seg: compact_segments_) {
+            ss << to_string<uint32_t>(seg.x_offset);
+            ss << to_string<float>(seg.slope);
+            ss << to_string<float>(seg.y);
+        }
+        return ss.str();
+    }
+
+    void Decode(const std::string &encoded_str) {
+        compact_ = to_type<uint8_t>(encoded_str.substr(0, 1)) == 1;
+        compact_segments_.clear();
+        if (!compact_) {
+            wide_ = PLRDataRep<N, D>(encoded_str.substr(1));
+            gamma_ = wide_.GetGamma();
+            return;
+        }
+        size_t ptr = 1;
+        gamma_ = to_type<D>(encoded_str.substr(ptr, sizeof(D)));
+        ptr += sizeof(D);
+        base_ = to_type<N>(encoded_str.substr(ptr, sizeof(N)));
+        ptr += sizeof(N);
+        assert((encoded_str.size() - ptr) % sizeof(CompactSegment) == 0);
+        compact_segments_.reserve((encoded_str.size() - ptr) / sizeof(CompactSegment));
+        while (ptr < encoded_str.size()) {
+            auto x_offset = to_type<uint32_t>(encoded_str.substr(ptr, sizeof(uint32_t)));
+            ptr += sizeof(uint32_t);
+            auto slope = to_type<float>(encoded_str.substr(ptr, sizeof(float)));
+            ptr += sizeof(float);
+            auto y = to_type<float>(encoded_str.substr(ptr, sizeof(float)));
+            ptr += sizeof(float);
+            compact_segments_.emplace_back(x_offset, slope, y);
+        }
+    }
+
+    bool IsCompact() const {
+        return compact_;
+    }
+
+    D GetGamma() const {
+        return gamma_;
+    }
+
+    // Bytes held by the segment array
+    size_t SegmentBytes() const {
+        return compact_ ? compact_segments_.size() * sizeof(CompactSegment)
+                        : wide_.GetSegs().size() * sizeof(Segment<N, D>);
+    }
+
+    // Same contract as PLRDataRep::GetValue()
+    std::pair<N, N> GetValue(N key) const {
+        if (!compact_) {
+            return wide_.GetValue(key);
+        }
+        if (compact_segments_.empty()) {
+            return std::pair<N, N>();
+        }
+        return predictionWindow<N, D>(predict_(key), gamma_);
+    }
+
+private:
+    D gamma_;
+    N base_;
+    bool compact_ = false;
+    std::vector<CompactSegment> compact_segments_;
+    PLRDataRep<N, D> wide_;
+
+    template<typename Alloc>
+    bool toCompact_(const PLRDataRep<N, D, Alloc> &model) {
+        const auto &segs = model.GetSegs();
+        base_ = segs.front().x_start;
+        for (auto &seg: segs) {
+            if (seg.x_start - base_ > std::numeric_limits<uint32_t>::max()) {
+                return false;
+            }
+            D y = (model.GetSegmentOrigin() == SEGMENT_ORIGIN::SEGMENT_START) ? seg.y : seg.slope * seg.x_start + seg.y;
+            compact_segments_.emplace_back(static_cast<uint32_t>(seg.x_start - base_), static_cast<float>(seg.slope),
+                                           static_cast<float>(y));
+        }
+        return true;
+    }
+
+    template<typename P>
+    bool verify_(const N *keys, const P *positions, size_t count) const {
+        for (size_t i = 0; i < count; i++) {
+            auto window = predictionWindow<N, D>(predict_(keys[i]), gamma_);
+            D position = static_cast<D>(positions[i]);
+            if (position < window.first || position > window.second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    D predict_(N key) const {
+        if (key < base_) {
+            const auto &seg = compact_segments_.front();
+            return static_cast<D>(seg.slope) * keyOffset<N, D>(key, base_ + seg.x_offset) + static_cast<D>(seg.y);
+        }
+        N offset = key - base_;
+        // The last segment with x_offset <= offset
+        auto it = std::upper_bound(compact_segments_.begin(), compact_segments_.end(), offset,
+                                   [](N o, const CompactSegment &seg) { return o < seg.x_offset; });
+        const auto &seg = (it == compact_segments_.begin()) ? *it : *(--it);
+        return static_cast<D>(seg.slope) * static_cast<D>(offset - seg.x_offset) + static_cast<D>(seg.y);
+    }
+};
+
+#endif //PLR_COMPACT_PLR_H
@@ -0,0 +1,140 @@
+#include <vector>
+#include <queue>
+#include <utility>
+#include <functional>
+#include "library.h"
+#include "block_plr.h"
+
+#ifndef PLR_COMPACTION_PLR_H
+#define PLR_COMPACTION_PLR_H
+
+// K-way merge of sorted runs of keys, as done by a compaction
+// Equal keys come out in run order, so with the newest run first, the first of them is the live one.
+template<typename N>
+class MergeIterator {
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    // REQUIRED: every run is sorted and outlives the iterator
+    MergeIterator(const std::vector<std::pair<const N *, size_t>> &_runs) : runs(_runs), cursors(_runs.size(), 0) {
+        for (size_t r = 0; r < runs.size(); r++) {
+            if (runs[r].second != 0) {
+                heap.emplace(runs[r].first[0], r);
+            }
+        }
+    }
+
+    bool valid() const {
+        return !heap.empty();
+    }
+
+    // REQUIRED: valid()
+    N key() const {
+        return heap.top().first;
+    }
+
+    // The run of key()
+    // REQUIRED: valid()
+    size_t run() const {
+        return heap.top().second;
+    }
+
+    // REQUIRED: valid()
+    void next() {
+        size_t r = heap.top().second;
+        heap.pop();
+        if (++cursors[r] < runs[r].second) {
+            heap.emplace(runs[r].first[cursors[r]], r);
+        }
+    }
+
+private:
+    std::vector<std::pair<const N *, size_t>> runs;
+    std::vector<size_t> cursors;
+    // Smallest key first, then smallest run
+    std::priority_queue<std::pair<N, size_t>, std::vector<std::pair<N, size_t>>,
+            std::greater<std::pair<N, size_t>>> heap;
+};
+
+// PLR training attached to the output of a compaction
+// Keys are added as they come out of the merge, and the block writer calls endBlock() whenever it cuts a block,
+// so blocks may have any number of keys. Only the first and the last key of each block reach the trainer, as in
+// BlockBoundaryPLR, and keys are not buffered: the model is complete once the last block has ended.
+template<typename N, typename D>
+class CompactionPLRBuilder {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    CompactionPLRBuilder(D _gamma, SEGMENT_ORIGIN _segment_origin = defaultSegmentOrigin<N>())
+            : gamma(_gamma), segment_origin(_segment_origin), plr(_gamma, _segment_origin) {}
+
+    // Add the next output key to the current block
+    // Return false, without adding it, if key <= the last added key (an older version of the same key)
+    // REQUIRED: Has not been called finish()
+    bool add(N key) {
+        if (key_count != 0 && key <= last_key) {
+            return false;
+        }
+        if (block_keys == 0) {
+            first_key = key;
+        }
+        last_key = key;
+        block_keys++;
+        key_count++;
+        return true;
+    }
+
+    // End the current block, ignored if it has no key
+    // REQUIRED: Has not been called finish()
+    void endBlock() {
+        if (block_keys == 0) {
+            return;
+        }
+        plr.addBlock(first_key, last_key, static_cast<D>(block_count));
+        block_count++;
+        block_keys = 0;
+    }
+
+    // End the last block and return the model
+    // REQUIRED: Has not been called finish()
+    PLRDataRep<N, D> finish() {
+        endBlock();
+        return PLRDataRep<N, D>(gamma, plr.finish(), segment_origin);
+    }
+
+    // Merge the runs into blocks of keys_per_block keys, call write(key, block) for every output key, and
+    // return the model of the output
+    // REQUIRED: no key has been added
+    template<typename Write>
+    PLRDataRep<N, D> build(MergeIterator<N> &merge, size_t keys_per_block, Write write) {
+        for (; merge.valid(); merge.next()) {
+            if (!add(merge.key())) {
+                continue;
+            }
+            write(merge.key(), block_count);
+            if (block_keys == keys_per_block) {
+                endBlock();
+            }
+        }
+        return finish();
+    }
+
+    size_t GetKeyCount() const {
+        return key_count;
+    }
+
+    size_t GetBlockCount() const {
+        return block_count;
+    }
+
+private:
+    D gamma;
+    SEGMENT_ORIGIN segment_origin;
+    BlockBoundaryPLR<N, D> plr;
+    N first_key = 0;
+    N last_key = 0;
+    size_t block_keys = 0;
+    size_t block_count = 0;
+    size_t key_count = 0;
+};
+
+#endif //PLR_COMPACTION_PLR_H
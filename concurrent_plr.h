@@ -0,0 +1,199 @@
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "library.h"
+
+#ifndef PLR_CONCURRENT_PLR_H
+#define PLR_CONCURRENT_PLR_H
+
+// A PLR model which serves GetValue() from any thread while one writer thread is still training it
+// Closed segments are appended to a segment array made of chunks of doubling size: a published segment never
+// moves, and the writer publishes the array length with a release store after writing the segment, so readers
+// only search segments that are fully written, without locks.
+// The open segment (the current GreedyPLR cone) is republished after every point through a sequence lock, and
+// readers use it as a provisional prediction for the keys after the last closed segment.
+// Every prediction, closed or provisional, is within gamma of the points processed so far.
+template<typename N, typename D>
+class ConcurrentPLR {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    ConcurrentPLR(D _gamma, GREEDY_PLR_GAP_MODE _gap_mode = GREEDY_PLR_GAP_MODE::CLOSED_FORM,
+                  SEGMENT_ORIGIN _segment_origin = defaultSegmentOrigin<N>())
+            : gamma(_gamma), segment_origin(_segment_origin),
+              plr(_gamma, [this](const Segment<N, D> &seg) { append_(seg); }, _gap_mode, _segment_origin) {
+        for (auto &chunk: chunks) {
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ConcurrentPLR(const ConcurrentPLR &) = delete;
+
+    ConcurrentPLR &operator=(const ConcurrentPLR &) = delete;
+
+    ~ConcurrentPLR() {
+        for (auto &chunk: chunks) {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Writer only: process a key and its position (or block id)
+    // REQUIRED: finish() has not been called
+    void process(N key, D y) {
+        plr.process(key, y);
+        publishOpen_();
+    }
+
+    // Writer only: close the open segment, the model then only changes by being destroyed
+    // REQUIRED: Has not been called finish()
+    void finish() {
+        plr.finish();
+        publishOpen_();
+    }
+
+    // Any thread: same contract as PLRDataRep::GetValue(), over the segments published so far
+    std::pair<N, N> GetValue(N key) const {
+        Segment<N, D> seg;
+        if (!find_(key, seg)) {
+            return std::pair<N, N>();
+        }
+        return predictionWindow<N, D>(segmentPrediction(seg, key, segment_origin), gamma);
+    }
+
+    // Any thread: the number of closed segments published so far
+    size_t GetSegmentCount() const {
+        return length.load(std::memory_order_acquire);
+    }
+
+    // Any thread: a copy of the published model, with the open segment closed where it is now
+    PLRDataRep<N, D> Snapshot() const {
+        PLRDataRep<N, D> model(gamma, segment_origin);
+        // The open segment first, see find_()
+        Segment<N, D> open;
+        bool has_open = loadOpen_(open);
+        size_t len = length.load(std::memory_order_acquire);
+        for (size_t i = 0; i < len; i++) {
+            model.Add(at_(i));
+        }
+        if (has_open && (len == 0 || open.x_start > at_(len - 1).x_start)) {
+            model.Add(open);
+        }
+        return model;
+    }
+
+private:
+    static constexpr size_t FIRST_CHUNK_SIZE = 256;
+    static constexpr size_t MAX_CHUNKS = 48;
+
+    D gamma;
+    SEGMENT_ORIGIN segment_origin;
+    GreedyPLR<N, D> plr;
+    std::atomic<Segment<N, D> *> chunks[MAX_CHUNKS];
+    std::atomic<size_t> length{0};
+    // The open segment, valid if open_valid; open_seq is odd while the writer updates it
+    std::atomic<uint64_t> open_seq{0};
+    std::atomic<bool> open_valid{false};
+    std::atomic<N> open_x_start{0};
+    std::atomic<D> open_slope{0};
+    std::atomic<D> open_y{0};
+
+    // Chunk k holds FIRST_CHUNK_SIZE << k segments, from index FIRST_CHUNK_SIZE * (2^k - 1)
+    static size_t chunkOf_(size_t i) {
+        return 63 - __builtin_clzll(static_cast<unsigned long long>(i / FIRST_CHUNK_SIZE + 1));
+    }
+
+    static size_t chunkStart_(size_t k) {
+        return FIRST_CHUNK_SIZE * ((static_cast<size_t>(1) << k) - 1);
+    }
+
+    // REQUIRED: i < a length loaded with acquire
+    Segment<N, D> at_(size_t i) const {
+        size_t k = chunkOf_(i);
+        return chunks[k].load(std::memory_order_relaxed)[i - chunkStart_(k)];
+    }
+
+    void append_(const Segment<N, D> &seg) {
+        size_t i = length.load(std::memory_order_relaxed);
+        size_t k = chunkOf_(i);
+        Segment<N, D> *chunk = chunks[k].load(std::memory_order_relaxed);
+        if (chunk == nullptr) {
+            chunk = new Segment<N, D>[FIRST_CHUNK_SIZE << k];
+            chunks[k].store(chunk, std::memory_order_relaxed);
+        }
+        chunk[i - chunkStart_(k)] = seg;
+        // Publishes the segment and the chunk pointer
+        length.store(i + 1, std::memory_order_release);
+    }
+
+    void publishOpen_() {
+        Segment<N, D> open;
+        bool valid = plr.openSegment(open);
+        uint64_t seq = open_seq.load(std::memory_order_relaxed);
+        open_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        open_valid.store(valid, std::memory_order_relaxed);
+        if (valid) {
+            open_x_start.store(open.x_start, std::memory_order_relaxed);
+            open_slope.store(open.slope, std::memory_order_relaxed);
+            open_y.store(open.y, std::memory_order_relaxed);
+        }
+        open_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    bool loadOpen_(Segment<N, D> &open) const {
+        while (true) {
+            uint64_t seq = open_seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                continue;
+            }
+            bool valid = open_valid.load(std::memory_order_relaxed);
+            open = Segment<N, D>(open_x_start.load(std::memory_order_relaxed),
+                                 open_slope.load(std::memory_order_relaxed), open_y.load(std::memory_order_relaxed));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (open_seq.load(std::memory_order_relaxed) == seq) {
+                return valid;
+            }
+        }
+    }
+
+    // The last published segment with x_start <= key (the first one if there is none)
+    // The writer appends a closed segment before it publishes the next open segment, so the open segment is loaded
+    // before the length: seeing an open segment then implies seeing every segment closed before it. Loaded the
+    // other way round, a length from before the last close could be paired with the segment opened after it, and
+    // keys of the closed segment would fall back to the segment before it.
+    bool find_(N key, Segment<N, D> &seg) const {
+        Segment<N, D> open;
+        bool has_open = loadOpen_(open);
+        size_t len = length.load(std::memory_order_acquire);
+        // The first closed segment with x_start > key
+        size_t lo = 0, hi = len;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (at_(mid).x_start <= key) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo > 0) {
+            seg = at_(lo - 1);
+            // The open segment is stale if it was closed after it was loaded
+            if (has_open && open.x_start > seg.x_start && open.x_start <= key) {
+                seg = open;
+            }
+            return true;
+        }
+        if (has_open && (len == 0 || open.x_start <= key)) {
+            seg = open;
+            return true;
+        }
+        if (len > 0) {
+            seg = at_(0);
+            return true;
+        }
+        return false;
+    }
+};
+
+#endif //PLR_CONCURRENT_PLR_H
@@ -0,0 +1,120 @@
+#include <cstddef>
+#include <algorithm>
+#include <limits>
+
+#ifndef PLR_CONE_KERNEL_H
+#define PLR_CONE_KERNEL_H
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PLR_HAS_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+// Cone check kernels for the GreedyPLR bulk training loop
+// Points are given relative to the cone apex (dx, dy), and the cone is given by the slopes of its
+// lower and upper lines. A point is inside iff dx > prev_dx (keys strictly increase) and
+// lower < dy / dx < upper. Every point inside tightens the cone to the slopes of its +/- gamma bounds.
+// The kernels return the index of the first point outside the cone (count if there is none), with the
+// cone tightened by all points before it. Both kernels compute the same operations in the same order
+// (one reciprocal, three products, exact min/max), so the AVX2 kernel is bit-identical to the scalar one.
+
+enum CONE_KERNEL {
+    AUTO_KERNEL = 0, // AVX2 if the CPU supports it
+    SCALAR_KERNEL,
+    AVX2_KERNEL
+};
+
+template<typename D>
+size_t coneScanScalar(const D *dx, const D *dy, size_t count, D gamma, D &prev_dx, D &lower, D &upper) {
+    for (size_t j = 0; j < count; j++) {
+        if (!(dx[j] > prev_dx)) {
+            return j;
+        }
+        D inv = 1 / dx[j];
+        D slope = dy[j] * inv;
+        if (!(lower < slope && slope < upper)) {
+            return j;
+        }
+        upper = std::min(upper, (dy[j] + gamma) * inv);
+        lower = std::max(lower, (dy[j] - gamma) * inv);
+        prev_dx = dx[j];
+    }
+    return count;
+}
+
+#ifdef PLR_HAS_AVX2_KERNEL
+
+inline bool cpuSupportsAVX2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+// [fill, v0, v1, v2]
+__attribute__((target("avx2"))) inline __m256d coneShift1_(__m256d v, __m256d fill) {
+    return _mm256_blend_pd(_mm256_permute4x64_pd(v, _MM_SHUFFLE(2, 1, 0, 0)), fill, 0x1);
+}
+
+// [fill, fill, v0, v1]
+__attribute__((target("avx2"))) inline __m256d coneShift2_(__m256d v, __m256d fill) {
+    return _mm256_blend_pd(_mm256_permute4x64_pd(v, _MM_SHUFFLE(1, 0, 0, 0)), fill, 0x3);
+}
+
+// Checks 4 points per step: the cone each point is checked against is the prefix min/max
+// of the bounds of the points before it, computed with lane shifts
+__attribute__((target("avx2")))
+inline size_t coneScanAVX2(const double *dx, const double *dy, size_t count, double gamma,
+                           double &prev_dx, double &lower, double &upper) {
+    const __m256d one = _mm256_set1_pd(1);
+    const __m256d g = _mm256_set1_pd(gamma);
+    const __m256d pos_inf = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    const __m256d neg_inf = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+    size_t j = 0;
+    for (; j + 4 <= count; j += 4) {
+        __m256d x = _mm256_loadu_pd(dx + j);
+        __m256d y = _mm256_loadu_pd(dy + j);
+        __m256d inv = _mm256_div_pd(one, x);
+        __m256d slope = _mm256_mul_pd(y, inv);
+        __m256d su = _mm256_mul_pd(_mm256_add_pd(y, g), inv);
+        __m256d sl = _mm256_mul_pd(_mm256_sub_pd(y, g), inv);
+        // Inclusive prefix min/max over the lanes
+        __m256d su_pre = _mm256_min_pd(su, coneShift1_(su, pos_inf));
+        su_pre = _mm256_min_pd(su_pre, coneShift2_(su_pre, pos_inf));
+        __m256d sl_pre = _mm256_max_pd(sl, coneShift1_(sl, neg_inf));
+        sl_pre = _mm256_max_pd(sl_pre, coneShift2_(sl_pre, neg_inf));
+        // The cone before each lane
+        __m256d up = _mm256_min_pd(_mm256_set1_pd(upper), coneShift1_(su_pre, pos_inf));
+        __m256d lo = _mm256_max_pd(_mm256_set1_pd(lower), coneShift1_(sl_pre, neg_inf));
+        __m256d ok = _mm256_and_pd(_mm256_cmp_pd(x, coneShift1_(x, _mm256_set1_pd(prev_dx)), _CMP_GT_OQ),
+                                   _mm256_and_pd(_mm256_cmp_pd(lo, slope, _CMP_LT_OQ),
+                                                 _mm256_cmp_pd(slope, up, _CMP_LT_OQ)));
+        int bad = ~_mm256_movemask_pd(ok) & 0xF;
+        if (bad) {
+            // Finish the block in scalar, from the same cone
+            break;
+        }
+        upper = std::min(upper, _mm256_cvtsd_f64(_mm256_permute4x64_pd(su_pre, _MM_SHUFFLE(3, 3, 3, 3))));
+        lower = std::max(lower, _mm256_cvtsd_f64(_mm256_permute4x64_pd(sl_pre, _MM_SHUFFLE(3, 3, 3, 3))));
+        prev_dx = dx[j + 3];
+    }
+    return j + coneScanScalar(dx + j, dy + j, count - j, gamma, prev_dx, lower, upper);
+}
+
+#endif
+
+// Run the kernel selected by kernel, falling back to scalar where AVX2 is not available
+inline size_t coneScan(CONE_KERNEL kernel, const double *dx, const double *dy, size_t count, double gamma,
+                       double &prev_dx, double &lower, double &upper) {
+#ifdef PLR_HAS_AVX2_KERNEL
+    if (kernel != CONE_KERNEL::SCALAR_KERNEL && cpuSupportsAVX2()) {
+        return coneScanAVX2(dx, dy, count, gamma, prev_dx, lower, upper);
+    }
+#endif
+    return coneScanScalar(dx, dy, count, gamma, prev_dx, lower, upper);
+}
+
+template<typename D>
+size_t coneScan(CONE_KERNEL, const D *dx, const D *dy, size_t count, D gamma, D &prev_dx, D &lower, D &upper) {
+    return coneScanScalar(dx, dy, count, gamma, prev_dx, lower, upper);
+}
+
+#endif //PLR_CONE_KERNEL_H
@@ -0,0 +1,154 @@
+#include <thread>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include "library.h"
+
+#ifndef PLR_GAMMA_TUNER_H
+#define PLR_GAMMA_TUNER_H
+
+// Budget for a trained model, every limit must hold
+struct GammaBudget {
+    size_t max_segments = std::numeric_limits<size_t>::max();
+    size_t max_model_bytes = std::numeric_limits<size_t>::max(); // size of PLRDataRep::Encode()
+    size_t max_window = std::numeric_limits<size_t>::max(); // blocks in a GetValue() window
+};
+
+// The size/accuracy of one training pass
+template<typename D>
+struct GammaTradeoff {
+    D gamma;
+    size_t segments;
+    size_t model_bytes;
+    size_t max_window; // widest GetValue() window in blocks
+};
+
+template<typename D>
+struct GammaTuneResult {
+    bool feasible; // false if no gamma fits the budget, best is then the smallest model found
+    GammaTradeoff<D> best;
+    std::vector<GammaTradeoff<D>> evaluated; // every training pass, sorted by gamma
+};
+
+// Choose the smallest gamma (the most accurate model) whose GreedyPLR model fits the budget
+// The window limit caps gamma directly, since a GetValue() window spans at most ceil(2 * gamma) + 1 blocks.
+// The segment and byte limits are searched on a log scale: each round trains one model per thread with
+// the bulk GreedyPLR::train, and narrows [lo, hi] to the neighbours of the smallest fitting gamma,
+// until hi / lo < 1 + tolerance.
+template<typename N, typename D>
+class GammaTuner {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    GammaTuner(GammaBudget _budget, size_t _threads = 1, D _min_gamma = 0.01, D _tolerance = 0.01)
+            : budget(_budget), threads(std::max<size_t>(1, _threads)), min_gamma(_min_gamma), tolerance(_tolerance) {}
+
+    // Tune over a sorted array of keys and their positions (or block ids)
+    // REQUIRED: keys are sorted
+    template<typename P>
+    GammaTuneResult<D> tune(const N *keys, const P *positions, size_t count) {
+        D range = count ? static_cast<D>(positions[count - 1]) - static_cast<D>(positions[0]) : 0;
+        return tune_(range, [keys, positions, count](D gamma) {
+            return GreedyPLR<N, D>(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM).train(keys, positions, count).size();
+        });
+    }
+
+    // Tune over a sorted array of keys, the i-th key has position i
+    // REQUIRED: keys are sorted
+    GammaTuneResult<D> tune(const N *keys, size_t count) {
+        D range = count ? static_cast<D>(count - 1) : 0;
+        return tune_(range, [keys, count](D gamma) {
+            return GreedyPLR<N, D>(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM).train(keys, count).size();
+        });
+    }
+
+    static size_t ModelBytes(size_t segments) {
+        return sizeof(D) + segments * sizeof(Segment<N, D>);
+    }
+
+    static size_t MaxWindow(D gamma) {
+        return static_cast<size_t>(std::ceil(2 * gamma)) + 1;
+    }
+
+private:
+    GammaBudget budget;
+    size_t threads;
+    D min_gamma;
+    D tolerance;
+
+    bool fits_(const GammaTradeoff<D> &t) const {
+        return t.segments <= budget.max_segments && t.model_bytes <= budget.max_model_bytes &&
+               t.max_window <= budget.max_window;
+    }
+
+    // countSegments(gamma) trains a model and returns its segment count
+    template<typename CountFn>
+    GammaTuneResult<D> tune_(D range, CountFn countSegments) {
+        GammaTuneResult<D> result{};
+        auto evaluate = [&](const std::vector<D> &gammas) {
+            std::vector<GammaTradeoff<D>> passes(gammas.size());
+            std::vector<std::thread> workers;
+            for (size_t i = 1; i < gammas.size(); i++) {
+                workers.emplace_back([&passes, &gammas, &countSegments, i, this]() {
+                    passes[i] = tradeoff_(gammas[i], countSegments(gammas[i]));
+                });
+            }
+            passes[0] = tradeoff_(gammas[0], countSegments(gammas[0]));
+            for (auto &worker: workers) {
+                worker.join();
+            }
+            result.evaluated.insert(result.evaluated.end(), passes.begin(), passes.end());
+            return passes;
+        };
+
+        // Above half of the position range a single segment always fits
+        D hi = std::max(min_gamma, range / 2 + 1);
+        if (budget.max_window != std::numeric_limits<size_t>::max() && budget.max_window != 0) {
+            hi = std::min(hi, static_cast<D>(budget.max_window - 1) / 2);
+        }
+        D lo = min_gamma;
+        if (budget.max_window == 0 || hi < lo) {
+            // Even min_gamma exceeds the window limit (a window has at least one block)
+            result.feasible = false;
+            result.best = evaluate({lo})[0];
+            return result;
+        }
+        auto best = evaluate({hi})[0];
+        result.feasible = fits_(best);
+        if (result.feasible) {
+            while (hi / lo > 1 + tolerance) {
+                // threads gammas strictly inside (lo, hi), evenly spaced on a log scale
+                std::vector<D> gammas;
+                for (size_t i = 1; i <= threads; i++) {
+                    gammas.push_back(lo * std::pow(hi / lo, static_cast<D>(i) / (threads + 1)));
+                }
+                auto passes = evaluate(gammas);
+                size_t first_fit = passes.size();
+                for (size_t i = 0; i < passes.size(); i++) {
+                    if (fits_(passes[i])) {
+                        first_fit = i;
+                        break;
+                    }
+                }
+                if (first_fit < passes.size()) {
+                    best = passes[first_fit];
+                    hi = passes[first_fit].gamma;
+                }
+                if (first_fit > 0) {
+                    lo = passes[first_fit - 1].gamma;
+                }
+            }
+        }
+        result.best = best;
+        std::sort(result.evaluated.begin(), result.evaluated.end(),
+                  [](const GammaTradeoff<D> &a, const GammaTradeoff<D> &b) { return a.gamma < b.gamma; });
+        return result;
+    }
+
+    GammaTradeoff<D> tradeoff_(D gamma, size_t segments) const {
+        return GammaTradeoff<D>{gamma, segments, ModelBytes(segments), MaxWindow(gamma)};
+    }
+};
+
+#endif //PLR_GAMMA_TUNER_H
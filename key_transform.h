@@ -0,0 +1,177 @@
+#include <cstddef>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#ifndef PLR_KEY_TRANSFORM_H
+#define PLR_KEY_TRANSFORM_H
+
+// Monotone key transforms, applied to every key before training and before lookups
+// A transform is described by its kind and a list of knots, which is all that the model encoding stores.
+enum KEY_TRANSFORM {
+    IDENTITY_TRANSFORM = 0,
+    LOG_TRANSFORM, // log2(key + 1) in fixed point, for keys spread over many orders of magnitude
+    PIECEWISE_SHIFT_TRANSFORM, // wide gaps between keys are shifted away, for bursty keys
+    CDF_TRANSFORM // monotone cubic approximation of the key CDF (scaled rank), for smooth skew
+};
+
+// A non-decreasing map from keys to keys
+// Distinct keys may collide after the transform (e.g. large keys under LOG_TRANSFORM), trainers must
+// account for it; knots are (key, transformed key) pairs for CDF_TRANSFORM and (key, shift) pairs for
+// PIECEWISE_SHIFT_TRANSFORM.
+// REQUIRED: keys are not negative
+template<typename N>
+class KeyTransform {
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    KeyTransform() : kind(KEY_TRANSFORM::IDENTITY_TRANSFORM) {}
+
+    KeyTransform(KEY_TRANSFORM _kind, std::vector<std::pair<N, N>> _knots) : kind(_kind), knots(std::move(_knots)) {}
+
+    static KeyTransform Log() {
+        return KeyTransform(KEY_TRANSFORM::LOG_TRANSFORM, {});
+    }
+
+    // Shrink every gap between consecutive sorted keys wider than max_gap to max_gap
+    // REQUIRED: keys are sorted, max_gap >= 1
+    static KeyTransform PiecewiseShift(const N *keys, size_t count, N max_gap) {
+        std::vector<std::pair<N, N>> knots;
+        N shift = 0;
+        for (size_t i = 1; i < count; i++) {
+            if (keys[i] - keys[i - 1] > max_gap) {
+                shift += keys[i] - keys[i - 1] - max_gap;
+                knots.emplace_back(keys[i], shift);
+            }
+        }
+        return KeyTransform(KEY_TRANSFORM::PIECEWISE_SHIFT_TRANSFORM, std::move(knots));
+    }
+
+    // Interpolate the rank of the keys between pieces + 1 sampled keys
+    // The rank is scaled by up to 2^16, so keys within a piece rarely collide
+    // REQUIRED: keys are sorted
+    static KeyTransform Cdf(const N *keys, size_t count, size_t pieces) {
+        std::vector<std::pair<N, N>> knots;
+        if (count == 0) {
+            return KeyTransform(KEY_TRANSFORM::CDF_TRANSFORM, std::move(knots));
+        }
+        pieces = std::max<size_t>(1, std::min(pieces, count - 1));
+        // Leave headroom above the scaled rank for keys past the last knot
+        int rank_bits = 0;
+        while (rank_bits < 63 && (static_cast<unsigned long long>(1) << rank_bits) < count) {
+            rank_bits++;
+        }
+        int scale_bits = std::numeric_limits<N>::digits - 2 - rank_bits;
+        scale_bits = (scale_bits > CDF_SCALE_BITS) ? CDF_SCALE_BITS : std::max(0, scale_bits);
+        for (size_t j = 0; j <= pieces; j++) {
+            size_t rank = (count - 1) * j / pieces;
+            if (knots.empty() || keys[rank] > knots.back().first) {
+                knots.emplace_back(keys[rank], static_cast<N>(rank) << scale_bits);
+            }
+        }
+        return KeyTransform(KEY_TRANSFORM::CDF_TRANSFORM, std::move(knots));
+    }
+
+    N operator()(N key) const {
+        switch (kind) {
+            case KEY_TRANSFORM::LOG_TRANSFORM:
+                return static_cast<N>(std::ldexp(std::log2(static_cast<long double>(key) + 1), LOG_FRACTION_BITS));
+            case KEY_TRANSFORM::PIECEWISE_SHIFT_TRANSFORM:
+                return shift_(key);
+            case KEY_TRANSFORM::CDF_TRANSFORM:
+                return cdf_(key);
+            default:
+                return key;
+        }
+    }
+
+    KEY_TRANSFORM GetKind() const {
+        return kind;
+    }
+
+    const std::vector<std::pair<N, N>> &GetKnots() const {
+        return knots;
+    }
+
+    bool IsIdentity() const {
+        return kind == KEY_TRANSFORM::IDENTITY_TRANSFORM;
+    }
+
+private:
+    static constexpr int CDF_SCALE_BITS = 16;
+    // log2 of a key is at most digits, keep its integer bits above the fraction
+    static constexpr int LOG_FRACTION_BITS = std::numeric_limits<N>::digits - (std::numeric_limits<N>::digits > 64 ? 8 : 7);
+
+    KEY_TRANSFORM kind;
+    std::vector<std::pair<N, N>> knots;
+
+    // The last knot with knot.first <= key, knots.end() if there is none
+    typename std::vector<std::pair<N, N>>::const_iterator knotOf_(N key) const {
+        auto it = std::upper_bound(knots.begin(), knots.end(), key,
+                                   [](N k, const std::pair<N, N> &knot) { return k < knot.first; });
+        return it == knots.begin() ? knots.end() : it - 1;
+    }
+
+    N shift_(N key) const {
+        auto it = knotOf_(key);
+        N shift = (it == knots.end()) ? 0 : it->second;
+        auto next = (it == knots.end()) ? knots.begin() : it + 1;
+        if (next != knots.end()) {
+            // Keys inside a shrunk gap stay below the key after the gap
+            return std::min<N>(key - shift, next->first - next->second - 1);
+        }
+        return key - shift;
+    }
+
+    N cdf_(N key) const {
+        if (knots.empty() || key <= knots.front().first) {
+            return knots.empty() ? key : knots.front().second;
+        }
+        auto it = knotOf_(key);
+        if (it + 1 == knots.end()) {
+            // One step per key past the last knot
+            N room = std::numeric_limits<N>::max() - it->second;
+            return it->second + std::min<N>(key - it->first, room);
+        }
+        // Monotone cubic Hermite interpolation (Fritsch-Butland slopes), which follows the curvature of the CDF
+        // between knots, a linear interpolation would only add breakpoints to the PLR
+        size_t k = it - knots.begin();
+        long double h = static_cast<long double>(knots[k + 1].first - knots[k].first);
+        long double dy = static_cast<long double>(knots[k + 1].second - knots[k].second);
+        long double t = static_cast<long double>(key - knots[k].first) / h;
+        long double m0 = cdfSlope_(k) * h;
+        long double m1 = cdfSlope_(k + 1) * h;
+        long double y = dy * t * t * (3 - 2 * t) + m0 * t * (1 - t) * (1 - t) - m1 * t * t * (1 - t);
+        y = std::min(std::max(y, static_cast<long double>(0)), dy);
+        return knots[k].second + static_cast<N>(y);
+    }
+
+    // Secant of knot piece k
+    long double cdfSecant_(size_t k) const {
+        return static_cast<long double>(knots[k + 1].second - knots[k].second) /
+               static_cast<long double>(knots[k + 1].first - knots[k].first);
+    }
+
+    // The derivative at knot k, a weighted harmonic mean of the secants around it
+    long double cdfSlope_(size_t k) const {
+        if (k == 0) {
+            return cdfSecant_(0);
+        }
+        if (k + 1 == knots.size()) {
+            return cdfSecant_(k - 1);
+        }
+        long double d0 = cdfSecant_(k - 1);
+        long double d1 = cdfSecant_(k);
+        if (d0 <= 0 || d1 <= 0) {
+            return 0;
+        }
+        long double h0 = static_cast<long double>(knots[k].first - knots[k - 1].first);
+        long double h1 = static_cast<long double>(knots[k + 1].first - knots[k].first);
+        long double w0 = 2 * h1 + h0;
+        long double w1 = h1 + 2 * h0;
+        return (w0 + w1) / (w0 / d0 + w1 / d1);
+    }
+};
+
+#endif //PLR_KEY_TRANSFORM_H
@@ -1,5 +1,6 @@
 #include <concepts>
 #include <cassert>
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <iostream>
@@ -7,6 +8,11 @@
 #include <sstream>
 #include <stdexcept>
 #include <cmath>
+#include <functional>
+#include <memory>
+#include <limits>
+#include "cone_kernel.h"
+#include "key_transform.h"
 
 #ifndef PLR_LIBRARY_H
 #define PLR_LIBRARY_H
@@ -52,14 +58,38 @@ N stringToNumber(std::string str) {
         char buffer[value_size];
         N value{};
     } obj;
-    size_t count = value_size - 1;
-    for (auto i = std::begin(str); i != std::end(str); i++) {
-        obj.buffer[count--] = *(i);
-//        std::cout << count << std::endl;
+    // Only the first value_size bytes are captured
+    size_t length = std::min(str.size(), value_size);
+    for (size_t i = 0; i < length; i++) {
+        obj.buffer[value_size - 1 - i] = str[i];
     }
     return obj.value;
 }
 
+// The longest common prefix of sorted keys, which is the common prefix of the first and the last key
+inline std::string longestCommonPrefix(const std::string *keys, size_t count) {
+    if (count == 0) {
+        return std::string();
+    }
+    const std::string &first = keys[0];
+    const std::string &last = keys[count - 1];
+    size_t length = 0;
+    while (length < first.size() && length < last.size() && first[length] == last[length]) {
+        length++;
+    }
+    return first.substr(0, length);
+}
+
+// Convert the bytes of key after prefix with stringToNumber()
+// Keys without the prefix are mapped below (or above) every key with it, so the order of keys is kept
+template<typename N>
+N stripPrefixToNumber(const std::string &key, const std::string &prefix) {
+    if (key.compare(0, prefix.size(), prefix) != 0) {
+        return key < prefix ? std::numeric_limits<N>::min() : std::numeric_limits<N>::max();
+    }
+    return stringToNumber<N>(key.substr(prefix.size()));
+}
+
 // A utility function for encoding any value to string
 // Encoding scheme will be memcpy()
 template<typename T>
@@ -157,12 +187,12 @@ struct __attribute__((packed)) Segment {
     N x_start; // The intersection pt x (since we can translate this pt exactly)
     D slope;
     D y; // The intersection pt y
-    bool operator==(const Segment<N, D> &another) {
+    bool operator==(const Segment<N, D> &another) const {
         return (this->x_start == another.x_start) && abs(this->slope - another.slope) < DELTA &&
                abs(this->y - another.y) < DELTA;
     }
 
-    bool operator!=(const Segment<N, D> &another) {
+    bool operator!=(const Segment<N, D> &another) const {
         return !this->operator==(another);
     }
 
@@ -183,20 +213,333 @@ enum GREEDY_PLR_STATE {
     FINISHED
 };
 
-// Greedy PLR Model
+// How GreedyPLR handles the gap between two consecutive keys
+// INTERPOLATE: feed synthetic points between last_pt and the new point (overshooting prevention)
+// CLOSED_FORM: treat the gap as one line-segment constraint, and split the segment analytically
+enum GREEDY_PLR_GAP_MODE {
+    INTERPOLATE = 0,
+    CLOSED_FORM
+};
+
+// Where the y of a Segment is anchored
+// KEY_ZERO: y is the intercept at key 0, prediction = slope * key + y
+// SEGMENT_START: y is the prediction at x_start, prediction = slope * (key - x_start) + y
+// SEGMENT_START computes on exact integer offsets from x_start, so the error bound still holds
+// for keys above 2^53 (64-bit or unsigned __int128 keys), which cannot be converted to double exactly.
+enum SEGMENT_ORIGIN {
+    KEY_ZERO = 0,
+    SEGMENT_START
+};
+
+// KEY_ZERO converts whole keys to floating point, keys wider than 64 bits are taken to be above 2^53, so their
+// models must use SEGMENT_START
+template<typename N>
+constexpr bool isSegmentOriginSupported(SEGMENT_ORIGIN origin) {
+    return sizeof(N) <= sizeof(uint64_t) || origin == SEGMENT_ORIGIN::SEGMENT_START;
+}
+
+// The segment origin of trainers and models not given one
+template<typename N>
+constexpr SEGMENT_ORIGIN defaultSegmentOrigin() {
+    return sizeof(N) <= sizeof(uint64_t) ? SEGMENT_ORIGIN::KEY_ZERO : SEGMENT_ORIGIN::SEGMENT_START;
+}
+
+// Convert a key distance to floating point
+template<typename D, typename N>
+D distanceToFloating(N distance) {
+    return static_cast<D>(distance);
+}
+
+#ifdef __SIZEOF_INT128__
+// Distances within a segment fit in 64 bits, which convert in one instruction instead of the 128-bit routine
+template<typename D>
+D distanceToFloating(unsigned __int128 distance) {
+    return (distance >> 64) == 0 ? static_cast<D>(static_cast<uint64_t>(distance)) : static_cast<D>(distance);
+}
+#endif
+
+// Signed distance from origin to key, converted to floating point
 template<typename N, typename D>
+D keyOffset(N key, N origin) {
+    return key >= origin ? distanceToFloating<D>(key - origin) : -distanceToFloating<D>(origin - key);
+}
+
+// The prediction of seg at key
+template<typename N, typename D>
+D segmentPrediction(const Segment<N, D> &seg, N key, SEGMENT_ORIGIN origin) {
+    if (origin == SEGMENT_ORIGIN::SEGMENT_START) {
+        return seg.slope * keyOffset<N, D>(key, seg.x_start) + seg.y;
+    }
+    return seg.slope * key + seg.y;
+}
+
+// The largest |prediction - position| of segments over sorted keys, walking both in key order
+template<typename N, typename D, typename Alloc, typename PositionFn>
+D maxSegmentError(const std::vector<Segment<N, D>, Alloc> &segments, SEGMENT_ORIGIN origin, const N *keys,
+                  size_t count, PositionFn position) {
+    D max_error = 0;
+    if (segments.empty()) {
+        return max_error;
+    }
+    size_t s = 0;
+    for (size_t i = 0; i < count; i++) {
+        while (s + 1 < segments.size() && segments[s + 1].x_start <= keys[i]) {
+            s++;
+        }
+        max_error = std::max<D>(max_error, std::abs(segmentPrediction(segments[s], keys[i], origin) - position(i)));
+    }
+    return max_error;
+}
+
+// Relative and absolute margin of widenedGamma()
+const double PLR_ERROR_MARGIN = 1e-9;
+
+// The error bound of a model whose largest measured error is max_error, at least gamma
+// The margin keeps rounding in the measured error from excluding the key it was measured on.
+template<typename D>
+D widenedGamma(D gamma, D max_error) {
+    return std::max<D>(gamma, max_error * (1 + static_cast<D>(PLR_ERROR_MARGIN)) + static_cast<D>(PLR_ERROR_MARGIN));
+}
+
+// Relative margin of shrunkGamma()
+const double PLR_GAMMA_MARGIN = 1e-6;
+
+// The bound to train with for lookups within gamma
+// Fitted lines may touch the bound exactly, the margin keeps rounding in the lookup arithmetic from pushing a
+// prediction past gamma.
+template<typename D>
+D shrunkGamma(D gamma) {
+    return gamma * (1 - static_cast<D>(PLR_GAMMA_MARGIN));
+}
+
+// Receives every finalized segment, in key order
+template<typename N, typename D>
+using SegmentSink = std::function<void(const Segment<N, D> &)>;
+
+// Greedy PLR Model
+// Alloc allocates the segment buffer and the vectors returned by finish(); a trainer can be reset() and reused,
+// keeping its buffer, so each model then only allocates its exact size
+template<typename N, typename D, typename Alloc = std::allocator<Segment<N, D>>>
 class GreedyPLR {
     static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
     static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
 public:
-    GreedyPLR(D _gamma) : state(GREEDY_PLR_STATE::NEED_2_PT), gamma(_gamma) {}
+    GreedyPLR(D _gamma, GREEDY_PLR_GAP_MODE _gap_mode = GREEDY_PLR_GAP_MODE::INTERPOLATE,
+              SEGMENT_ORIGIN _segment_origin = defaultSegmentOrigin<N>(), const Alloc &alloc = Alloc())
+            : state(GREEDY_PLR_STATE::NEED_2_PT), gamma(_gamma), gap_mode(_gap_mode), segment_origin(_segment_origin),
+              last_pt(), s0(), s1(), pt_intersection_(), rho_lower(), rho_upper(), processed_segments(alloc) {
+        assert(isSegmentOriginSupported<N>(segment_origin));
+    }
+
+    // Streaming PLR Model: every segment is pushed to sink as soon as it is closed, instead of being
+    // collected in memory, so finish() returns an empty vector
+    GreedyPLR(D _gamma, SegmentSink<N, D> _sink, GREEDY_PLR_GAP_MODE _gap_mode = GREEDY_PLR_GAP_MODE::INTERPOLATE,
+              SEGMENT_ORIGIN _segment_origin = defaultSegmentOrigin<N>())
+            : GreedyPLR(_gamma, _gap_mode, _segment_origin) {
+        sink = std::move(_sink);
+    }
+
+    // Resume training from EncodeState()
+    // The trainer continues exactly where the encoded one stopped; the sink and the cone kernel are not encoded
+    explicit GreedyPLR(const std::string &encoded_state, SegmentSink<N, D> _sink = nullptr, const Alloc &alloc = Alloc())
+            : GreedyPLR(0, GREEDY_PLR_GAP_MODE::INTERPOLATE, defaultSegmentOrigin<N>(), alloc) {
+        sink = std::move(_sink);
+        DecodeState(encoded_state);
+    }
+
+    // Encode the training state, to be resumed by GreedyPLR(encoded_state)
+    // Closed segments are not included: hand them over with takeSegments() (or a sink) before encoding
+    // The open segment is part of the state, so the encoded trainer keeps extending it when resumed
+    // Encoding: uint32_t version, gamma, gap mode, segment origin, state, origin, dp_count, then the points
+    // last_pt, s0, s1, pt_intersection_, the lines rho_lower, rho_upper, and (since version 2) uint8_t monotone
+    // and the monotone floor
+    // REQUIRED: The PLR Model is not at the finishing state
+    std::string EncodeState() const {
+        assert(state != GREEDY_PLR_STATE::FINISHED);
+        std::stringstream ss;
+        ss << to_string<uint32_t>(STATE_ENCODING_VERSION);
+        ss << to_string<D>(gamma);
+        ss << to_string<uint8_t>(gap_mode);
+        ss << to_string<uint8_t>(segment_origin);
+        ss << to_string<uint8_t>(state);
+        ss << to_string<N>(origin);
+        ss << to_string<uint64_t>(dp_count);
+        for (auto &pt: {last_pt, s0, s1, pt_intersection_}) {
+            ss << to_string<D>(pt.x) << to_string<D>(pt.y);
+        }
+        for (auto &line: {rho_lower, rho_upper}) {
+            ss << to_string<D>(line.a1) << to_string<D>(line.a2);
+        }
+        ss << to_string<uint8_t>(monotone);
+        ss << to_string<D>(monotone_floor);
+        return ss.str();
+    }
+
+    // REQUIRED: String must be encoded from EncodeState() function.
+    void DecodeState(const std::string &encoded_state) {
+        size_t ptr = 0;
+        auto next = [&encoded_state, &ptr](size_t size) {
+            auto field = encoded_state.substr(ptr, size);
+            ptr += size;
+            return field;
+        };
+        auto version = to_type<uint32_t>(next(sizeof(uint32_t)));
+        assert(version >= 1 && version <= STATE_ENCODING_VERSION);
+        gamma = to_type<D>(next(sizeof(D)));
+        gap_mode = static_cast<GREEDY_PLR_GAP_MODE>(to_type<uint8_t>(next(1)));
+        segment_origin = static_cast<SEGMENT_ORIGIN>(to_type<uint8_t>(next(1)));
+        state = static_cast<GREEDY_PLR_STATE>(to_type<uint8_t>(next(1)));
+        origin = to_type<N>(next(sizeof(N)));
+        dp_count = to_type<uint64_t>(next(sizeof(uint64_t)));
+        for (auto pt: {&last_pt, &s0, &s1, &pt_intersection_}) {
+            pt->x = to_type<D>(next(sizeof(D)));
+            pt->y = to_type<D>(next(sizeof(D)));
+        }
+        for (auto line: {&rho_lower, &rho_upper}) {
+            line->a1 = to_type<D>(next(sizeof(D)));
+            line->a2 = to_type<D>(next(sizeof(D)));
+        }
+        // Version 1 has no monotone option
+        monotone = version >= 2 && to_type<uint8_t>(next(1)) != 0;
+        monotone_floor = (version >= 2) ? to_type<D>(next(sizeof(D))) : -std::numeric_limits<D>::infinity();
+        assert(ptr == encoded_state.size());
+        processed_segments.clear();
+    }
+
+    // Hand over the segments closed so far, without finishing the model
+    std::vector<Segment<N, D>, Alloc> takeSegments() {
+        std::vector<Segment<N, D>, Alloc> taken(processed_segments.get_allocator());
+        taken.swap(processed_segments);
+        return taken;
+    }
 
     // Process a point
     // This function will be recursively called with fillMiddleDataPt_
     // Return if pt.x < seg[-1].x_start
     // REQUIRED: The PLR Model is not at the finishing state
     void process(Point<double> pt) {
-        if (dp_count != 0 ) {
+        if (dp_count == 0 && segment_origin == SEGMENT_ORIGIN::SEGMENT_START) {
+            origin = static_cast<N>(pt.x);
+        }
+        rebase_();
+        processFrame_(Point<D>(pt.x - static_cast<D>(origin), pt.y));
+    }
+
+    // Process a key and its position
+    // With SEGMENT_START, the key is only used through its exact offset from the current segment start
+    // REQUIRED: The PLR Model is not at the finishing state
+    void process(N key, D y) {
+        if (dp_count == 0 && segment_origin == SEGMENT_ORIGIN::SEGMENT_START) {
+            origin = key;
+        }
+        rebase_();
+        processFrame_(Point<D>(keyOffset<N, D>(key, origin), y));
+    }
+
+    // Train the model over a sorted array of keys and their positions (or block ids)
+    // Equivalent to calling process() on every (key, position) pair and then finish(), within floating-point
+    // rounding: the cone is tightened on slopes around its apex, so segments may differ in their last bits (and
+    // rarely in where a segment is cut), with the same error bound
+    // REQUIRED: keys are sorted and above the keys processed before (e.g. by a trainer resumed from EncodeState())
+    template<typename P>
+    std::vector<Segment<N, D>, Alloc> train(const N *keys, const P *positions, size_t count) {
+        trainBulk_(keys, [positions](size_t i) { return static_cast<D>(positions[i]); }, count);
+        return finish();
+    }
+
+    // Train the model over a sorted array of keys, the i-th key has position first_position + i
+    // REQUIRED: keys are sorted and above the keys processed before
+    std::vector<Segment<N, D>, Alloc> train(const N *keys, size_t count, D first_position = 0) {
+        trainBulk_(keys, [first_position](size_t i) { return first_position + static_cast<D>(i); }, count);
+        return finish();
+    }
+
+    // Select the cone check kernel of the bulk train() loop
+    void setConeKernel(CONE_KERNEL kernel) {
+        cone_kernel = kernel;
+    }
+
+    // Make predictions non-decreasing over all keys, across segment boundaries too, so that a range scan can
+    // walk from one GetValue() window to the next. Every segment starts at or above the prediction of the previous
+    // segment at its last key, and has a non-negative slope. A closed-form split point is always within gamma of
+    // the closing segment, so starting there is feasible; if there is no split point, the new segment starts at
+    // the last point instead. This may cost some extra segments.
+    // REQUIRED: CLOSED_FORM gap mode, positions are non-decreasing, no point has been processed
+    void setMonotone(bool enable) {
+        assert(gap_mode == GREEDY_PLR_GAP_MODE::CLOSED_FORM);
+        monotone = enable;
+    }
+
+    // Start training a new model with the same gamma and modes
+    // The segments are dropped (finish() returned a copy of them), but their buffer is kept for the next model
+    void reset() {
+        state = GREEDY_PLR_STATE::NEED_2_PT;
+        origin = 0;
+        dp_count = 0;
+        monotone_floor = -std::numeric_limits<D>::infinity();
+        processed_segments.clear();
+    }
+
+    // The segment finish() would close now, over the points since the last closed segment
+    // Return false if there is no such point
+    bool openSegment(Segment<N, D> &seg) const {
+        switch (state) {
+            case GREEDY_PLR_STATE::NEED_1_PT:
+                seg = Segment<N, D>{origin + static_cast<N>(std::ceil(s0.x)), 0, std::max(s0.y, monotone_floor)};
+                return true;
+            case GREEDY_PLR_STATE::READY:
+                seg = current_segment();
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Finish the PLR Model
+    // REQUIRED: Has not been called finish()
+    std::vector<Segment<N, D>, Alloc> finish() {
+        assert(state != GREEDY_PLR_STATE::FINISHED);
+        Segment<N, D> open;
+        if (openSegment(open)) {
+            emit_(open);
+        }
+        state = GREEDY_PLR_STATE::FINISHED;
+        // Hand over an exact-size copy and keep the buffer, so a trainer reused through reset() does not regrow it
+        // (with an arena allocator, every regrown buffer would be left behind in the arena)
+        return std::vector<Segment<N, D>, Alloc>(processed_segments.begin(), processed_segments.end(),
+                                                 processed_segments.get_allocator());
+    }
+
+private:
+    GREEDY_PLR_STATE state;
+    D gamma;
+    GREEDY_PLR_GAP_MODE gap_mode;
+    SEGMENT_ORIGIN segment_origin;
+    // All points below are in the frame x = key - origin
+    // origin stays 0 for KEY_ZERO, and follows the current segment start for SEGMENT_START
+    N origin = 0;
+    Point<D> last_pt;
+    Point<D> s0;
+    Point<D> s1;
+    Point<D> pt_intersection_;
+    Line<D> rho_lower;
+    Line<D> rho_upper;
+    std::vector<Segment<N, D>, Alloc> processed_segments;
+    SegmentSink<N, D> sink;
+    size_t dp_count = 0;
+    CONE_KERNEL cone_kernel = CONE_KERNEL::AUTO_KERNEL;
+    bool monotone = false;
+    // The lowest prediction allowed at the start of the current segment, -infinity unless monotone
+    D monotone_floor = -std::numeric_limits<D>::infinity();
+
+    static constexpr size_t BULK_BLOCK_SIZE = 32;
+    static constexpr uint32_t STATE_ENCODING_VERSION = 2;
+
+    // Process a point in the frame of origin
+    void processFrame_(Point<D> pt) {
+        if (dp_count != 0 && gap_mode == GREEDY_PLR_GAP_MODE::CLOSED_FORM) {
+            processGap_(pt);
+        } else if (dp_count != 0) {
             int base = 100* std::pow(10, std::log(1/gamma)+gamma)*(std::max(1.0,log(pt.x- last_pt.x)));
             if (base >  pt.x - last_pt.x) {
                 base = (pt.x - last_pt.x >=100) ? 100: 1;
@@ -212,56 +555,141 @@ public:
                 cur_y += step_y;
                 processHelper(Point<D>(cur_x,cur_y));
             }
+            processHelper(pt);
+        } else {
+            processHelper(pt);
         }
-        processHelper(pt);
         last_pt = pt;
         dp_count++;
     }
 
-    // Finish the PLR Model
-    // REQUIRED: Has not been called finish()
-    std::vector<Segment<N, D>> finish() {
-        assert(state != GREEDY_PLR_STATE::FINISHED);
-        switch (state) {
-            case GREEDY_PLR_STATE::NEED_2_PT:
-                state = GREEDY_PLR_STATE::FINISHED;
-                break;
-            case GREEDY_PLR_STATE::NEED_1_PT:
-                state = GREEDY_PLR_STATE::FINISHED;
-                processed_segments.push_back(Segment<N, D>{static_cast<N>(s0.x), 0, s0.y});
-                break;
-            case GREEDY_PLR_STATE::READY:
-                state = GREEDY_PLR_STATE::FINISHED;
-                processed_segments.push_back(current_segment());
-                break;
-            default:
-                assert(false); // Unreachable code, suppress warning
+    // Move origin to the start of the current segment, so that offsets stay small
+    // Called between points only, the interpolation in processFrame_ never sees a frame change
+    void rebase_() {
+        if (segment_origin != SEGMENT_ORIGIN::SEGMENT_START || dp_count == 0) {
+            return;
+        }
+        D shift = std::ceil(s0.x);
+        if (shift == 0) {
+            return;
         }
-        // Unreachable state, no sure whether compiler require this
-        return processed_segments;
+        origin += static_cast<N>(shift);
+        s0.x -= shift;
+        s1.x -= shift;
+        last_pt.x -= shift;
+        pt_intersection_.x -= shift;
+        rho_lower.a2 += rho_lower.a1 * shift;
+        rho_upper.a2 += rho_upper.a1 * shift;
     }
 
-private:
-    GREEDY_PLR_STATE state;
-    D gamma;
-    Point<D> last_pt;
-    Point<D> s0;
-    Point<D> s1;
-    Point<D> pt_intersection_;
-    Line<D> rho_lower;
-    Line<D> rho_upper;
-    std::vector<Segment<N, D>> processed_segments;
-    size_t dp_count = 0;
+    void emit_(const Segment<N, D> &seg) {
+        if (sink) {
+            sink(seg);
+        } else {
+            processed_segments.push_back(seg);
+        }
+    }
 
     void setup_() {
         this->rho_lower = Line<D>(s0.getUpperBound(gamma), s1.getLowerBound(gamma));
-        this->rho_upper = Line<D>(s0.getLowerBound(gamma), s1.getUpperBound(gamma));
+        // Lines below monotone_floor at s0 are outside the cone
+        D lowest = std::min(std::max(s0.y - gamma, monotone_floor), s0.y + gamma);
+        this->rho_upper = Line<D>(Point<D>(s0.x, lowest), s1.getUpperBound(gamma));
         this->pt_intersection_ = this->rho_lower.getIntersection(rho_upper);
     }
 
-    Segment<N, D> current_segment() {
-        N segment_start = s0.x;
-        D avg_slope = (rho_upper.a1 + rho_lower.a1) / 2;
+    // The slope of the current segment, any slope between the extreme lines is within gamma
+    D segmentSlope_() const {
+        D slope = (rho_upper.a1 + rho_lower.a1) / 2;
+        if (monotone && slope < 0) {
+            slope = std::min<D>(0, rho_upper.a1);
+        }
+        return slope;
+    }
+
+    // Close the current segment, the next segment starts at ceil(next_start)
+    void closeSegment_(D next_start) {
+        if (monotone) {
+            // The prediction at the last key before the next segment
+            monotone_floor = pt_intersection_.y + segmentSlope_() * (std::ceil(next_start) - 1 - pt_intersection_.x);
+        }
+        emit_(current_segment());
+    }
+
+    // Bulk processing loop
+    // In CLOSED_FORM mode, the common case (point inside the cone) runs through coneScan() over blocks of
+    // points, without state dispatch; everything else goes through process()
+    template<typename PositionFn>
+    void trainBulk_(const N *keys, PositionFn position, size_t count) {
+        size_t i = 0;
+        D block_dx[BULK_BLOCK_SIZE];
+        D block_dy[BULK_BLOCK_SIZE];
+        if (gap_mode != GREEDY_PLR_GAP_MODE::CLOSED_FORM) {
+            for (; i < count; i++) {
+                process(keys[i], position(i));
+            }
+            return;
+        }
+        while (i < count) {
+            // Set up the cone through the state machine
+            while (i < count && state != GREEDY_PLR_STATE::READY) {
+                process(keys[i], position(i));
+                i++;
+            }
+            // Check the points in blocks against the cone, as slopes around the apex
+            const Point<D> apex = pt_intersection_;
+            D lower = rho_lower.a1;
+            D upper = rho_upper.a1;
+            D prev_dx = last_pt.x - apex.x;
+            size_t start = i;
+            while (i < count) {
+                size_t n = (count - i < BULK_BLOCK_SIZE) ? count - i : BULK_BLOCK_SIZE;
+                for (size_t j = 0; j < n; j++) {
+                    block_dx[j] = keyOffset<N, D>(keys[i + j], origin) - apex.x;
+                    block_dy[j] = position(i + j) - apex.y;
+                }
+                size_t inside = coneScan(cone_kernel, block_dx, block_dy, n, gamma, prev_dx, lower, upper);
+                i += inside;
+                if (inside < n) {
+                    break;
+                }
+            }
+            if (i > start) {
+                rho_lower = Line<D>(lower, apex.y - lower * apex.x);
+                rho_upper = Line<D>(upper, apex.y - upper * apex.x);
+                last_pt = Point<D>(keyOffset<N, D>(keys[i - 1], origin), position(i - 1));
+                dp_count += i - start;
+            }
+            if (i < count) {
+                // Cone violation or unsorted key, let process() split the segment
+                process(keys[i], position(i));
+                i++;
+            }
+        }
+    }
+
+    // Tighten the cone so that every line inside it passes within gamma of pt
+    void tighten_(Point<D> pt) {
+        auto s_upper = pt.getUpperBound(gamma);
+        auto s_lower = pt.getLowerBound(gamma);
+
+        if (rho_upper.below(s_upper)) {
+            rho_upper = Line<D>(pt_intersection_, s_upper);
+        }
+        if (rho_lower.above(s_lower)) {
+            rho_lower = Line<D>(pt_intersection_, s_lower);
+        }
+    }
+
+    Segment<N, D> current_segment() const {
+        // s0 may be a split point inside a gap, the segment covers the keys from ceil(s0.x)
+        D start = std::ceil(s0.x);
+        N segment_start = origin + static_cast<N>(start);
+        D avg_slope = segmentSlope_();
+        if (segment_origin == SEGMENT_ORIGIN::SEGMENT_START) {
+            // The prediction at segment_start
+            return Segment<N, D>{segment_start, avg_slope, avg_slope * (start - pt_intersection_.x) + pt_intersection_.y};
+        }
         D intercept = -avg_slope * pt_intersection_.x + pt_intersection_.y;
         return Segment<N, D>{segment_start, avg_slope, intercept};
     }
@@ -269,7 +697,7 @@ private:
     void processHelper(Point<D> pt) {
         assert(state != GREEDY_PLR_STATE::FINISHED);
         // if the current feeding data point is < current segment x_start, return
-        if (pt.x <= last_pt.x) {
+        if (dp_count != 0 && pt.x <= last_pt.x) {
             return;
         }
         switch (state) {
@@ -296,17 +724,58 @@ private:
             auto prev_segment = current_segment();
             s0 = pt;
             state = GREEDY_PLR_STATE::NEED_1_PT;
-            processed_segments.push_back(prev_segment);
+            emit_(prev_segment);
         }
-        auto s_upper = pt.getUpperBound(gamma);
-        auto s_lower = pt.getLowerBound(gamma);
+        tighten_(pt);
+    }
 
-        if (rho_upper.below(s_upper)) {
-            rho_upper = Line<D>(pt_intersection_, s_upper);
+    // Process the line segment last_pt -> pt as one constraint (CLOSED_FORM mode)
+    // Every point on the segment lies within the cone iff both ends do, so only pt is checked.
+    // If pt is outside, the current segment is closed where last_pt -> pt crosses the violated boundary,
+    // and the new segment starts from that split point with pt as its second point.
+    void processGap_(Point<D> pt) {
+        if (state != GREEDY_PLR_STATE::READY || pt.x <= last_pt.x) {
+            processHelper(pt);
+            return;
         }
-        if (rho_lower.above(s_lower)) {
-            rho_lower = Line<D>(pt_intersection_, s_lower);
+        if (rho_lower.above(pt) && rho_upper.below(pt)) {
+            tighten_(pt);
+            return;
         }
+        const Line<D> &boundary = rho_upper.below(pt) ? rho_lower : rho_upper;
+        D f0 = last_pt.y - (boundary.a1 * last_pt.x + boundary.a2);
+        D f1 = pt.y - (boundary.a1 * pt.x + boundary.a2);
+        D t = f0 / (f0 - f1);
+        if (t >= 1) {
+            // pt is on the violated boundary, so the whole gap is inside the cone
+            tighten_(pt);
+            return;
+        }
+        Point<D> split(last_pt.x + t * (pt.x - last_pt.x), last_pt.y + t * (pt.y - last_pt.y));
+        if (!(t > 0 && split.x > last_pt.x && split.x < pt.x)) {
+            if (monotone) {
+                // Restart from last_pt, where the closing segment is within gamma; a closing segment which
+                // would only cover last_pt is replaced by the new one
+                if (std::ceil(s0.x) < std::ceil(last_pt.x)) {
+                    closeSegment_(last_pt.x);
+                }
+                s0 = last_pt;
+                s1 = pt;
+                setup_();
+                return;
+            }
+            // No room for a split point inside the gap, start the new segment at pt
+            emit_(current_segment());
+            s0 = pt;
+            state = GREEDY_PLR_STATE::NEED_1_PT;
+            return;
+        }
+        // Keep the gap before the split point within gamma of the closing segment
+        tighten_(split);
+        closeSegment_(split.x);
+        s0 = split;
+        s1 = pt;
+        setup_();
     }
 
     // This function avoids the overshooting issues of predicting data block due to lack of data point
@@ -351,24 +820,73 @@ private:
     }
 };
 
+// The [lower bound, upper bound] block window of a prediction tar with error bound gamma
+template<typename N, typename D>
+std::pair<N, N> predictionWindow(D tar, D gamma) {
+    D lower_bound = floor(tar - gamma);
+    D upper_bound = floor((tar + gamma));
+    lower_bound = (lower_bound < 0) ? 0 : lower_bound;
+    upper_bound = (upper_bound < 0) ? 0 : upper_bound;
+    return std::pair<N, N>(round(lower_bound), round(upper_bound));
+}
+
+// Flags of the extended PLRDataRep encoding
+const uint32_t PLR_FLAG_SEGMENT_START = 1; // Segments use SEGMENT_ORIGIN::SEGMENT_START
+const uint32_t PLR_FLAG_KEY_TRANSFORM = 2; // Keys go through a KeyTransform, encoded after the flags
+const uint32_t PLR_FLAG_KEY_PREFIX = 4; // String keys share a prefix, encoded after the transform
+
 // A class which represents a trained PLR Model Data
 // It can be constructed in two ways
 // 1. By converting constructor from gamma (error bound)
 // 2. By converting constructor from an encoded string
 // REQUIRED: String must be encoded from Encode() function.
-template<typename N, typename D>
+// Encoding: gamma, then every segment as x_start, slope, y
+// A model with non-default options stores -gamma instead, followed by uint32_t flags (PLR_FLAG_*)
+// With PLR_FLAG_KEY_TRANSFORM the flags are followed by uint8_t transform kind, uint32_t knot count and the knots
+// Segments of a model with a KeyTransform start at transformed keys
+// With PLR_FLAG_KEY_PREFIX they are followed by uint32_t prefix length and the prefix bytes
+// Alloc allocates the segment array
+template<typename N, typename D, typename Alloc = std::allocator<Segment<N, D>>>
 class PLRDataRep {
 public:
     void Decode(const std::string &encoded_str) {
         const size_t elementSize = sizeof(Segment<N, D>);
-        size_t count = encoded_str.size() / elementSize;
         size_t ptr = 0;
         size_t sizeN = sizeof(N);
         size_t sizeD = sizeof(D);
 
-        assert(encoded_str.size() % elementSize == sizeD);
         this->gamma_ = to_type<D>(encoded_str.substr(ptr, sizeD));
         ptr += sizeD;
+        if (std::signbit(this->gamma_)) {
+            this->gamma_ = -this->gamma_;
+            auto flags = to_type<uint32_t>(encoded_str.substr(ptr, sizeof(uint32_t)));
+            ptr += sizeof(uint32_t);
+            this->origin_ = (flags & PLR_FLAG_SEGMENT_START) ? SEGMENT_ORIGIN::SEGMENT_START : SEGMENT_ORIGIN::KEY_ZERO;
+            if (flags & PLR_FLAG_KEY_TRANSFORM) {
+                auto kind = static_cast<KEY_TRANSFORM>(to_type<uint8_t>(encoded_str.substr(ptr, 1)));
+                ptr += 1;
+                auto knot_count = to_type<uint32_t>(encoded_str.substr(ptr, sizeof(uint32_t)));
+                ptr += sizeof(uint32_t);
+                std::vector<std::pair<N, N>> knots;
+                for (uint32_t i = 0; i < knot_count; i++) {
+                    auto first = to_type<N>(encoded_str.substr(ptr, sizeN));
+                    ptr += sizeN;
+                    auto second = to_type<N>(encoded_str.substr(ptr, sizeN));
+                    ptr += sizeN;
+                    knots.emplace_back(first, second);
+                }
+                this->transform_ = KeyTransform<N>(kind, std::move(knots));
+            }
+            if (flags & PLR_FLAG_KEY_PREFIX) {
+                auto length = to_type<uint32_t>(encoded_str.substr(ptr, sizeof(uint32_t)));
+                ptr += sizeof(uint32_t);
+                this->key_prefix_ = encoded_str.substr(ptr, length);
+                ptr += length;
+            }
+        }
+        assert((encoded_str.size() - ptr) % elementSize == 0);
+        size_t count = (encoded_str.size() - ptr) / elementSize;
+        segments_.reserve(segments_.size() + count);
         for (size_t i = 0; i < count; i++) {
             auto n1 = encoded_str.substr(ptr, sizeN);
             ptr += sizeN;
@@ -382,7 +900,33 @@ public:
 
     std::string Encode() {
         std::stringstream ss;
-        ss << to_string<D>(gamma_);
+        uint32_t flags = 0;
+        if (origin_ == SEGMENT_ORIGIN::SEGMENT_START) {
+            flags |= PLR_FLAG_SEGMENT_START;
+        }
+        if (!transform_.IsIdentity()) {
+            flags |= PLR_FLAG_KEY_TRANSFORM;
+        }
+        if (!key_prefix_.empty()) {
+            flags |= PLR_FLAG_KEY_PREFIX;
+        }
+        if (flags == 0) {
+            ss << to_string<D>(gamma_);
+        } else {
+            ss << to_string<D>(-gamma_);
+            ss << to_string<uint32_t>(flags);
+            if (flags & PLR_FLAG_KEY_TRANSFORM) {
+                ss << to_string<uint8_t>(transform_.GetKind());
+                ss << to_string<uint32_t>(transform_.GetKnots().size());
+                for (auto &knot: transform_.GetKnots()) {
+                    ss << to_string<N>(knot.first) << to_string<N>(knot.second);
+                }
+            }
+            if (flags & PLR_FLAG_KEY_PREFIX) {
+                ss << to_string<uint32_t>(key_prefix_.size());
+                ss << key_prefix_;
+            }
+        }
         for (auto i: segments_) {
             N n1 = i.x_start;
             D d1 = i.slope;
@@ -397,16 +941,30 @@ public:
 
     PLRDataRep() = delete;
 
-    PLRDataRep(D gamma) : gamma_(gamma), segments_() {}
+    PLRDataRep(D gamma, SEGMENT_ORIGIN origin = defaultSegmentOrigin<N>(), const Alloc &alloc = Alloc())
+            : gamma_(gamma), origin_(origin), segments_(alloc) {
+        assert(isSegmentOriginSupported<N>(origin));
+    }
 
-    PLRDataRep(D gamma, const std::vector<Segment<N, D>> &another) : gamma_(gamma), segments_(another) {}
+    PLRDataRep(D gamma, const std::vector<Segment<N, D>, Alloc> &another,
+               SEGMENT_ORIGIN origin = defaultSegmentOrigin<N>())
+            : gamma_(gamma), origin_(origin), segments_(another) {
+        assert(isSegmentOriginSupported<N>(origin));
+    }
+
+    // Take over the segments without copying, e.g. PLRDataRep(gamma, plr.finish())
+    PLRDataRep(D gamma, std::vector<Segment<N, D>, Alloc> &&another,
+               SEGMENT_ORIGIN origin = defaultSegmentOrigin<N>())
+            : gamma_(gamma), origin_(origin), segments_(std::move(another)) {
+        assert(isSegmentOriginSupported<N>(origin));
+    }
 
     void Add(Segment<N, D> seg) {
         segments_.push_back(seg);
     }
 
 
-    PLRDataRep(std::string encoded_str) {
+    PLRDataRep(std::string encoded_str, const Alloc &alloc = Alloc()) : segments_(alloc) {
         Decode(encoded_str);
     }
 
@@ -414,24 +972,58 @@ public:
         return gamma_;
     }
 
-    std::vector<Segment<N, D>> GetSegs() const {
+    SEGMENT_ORIGIN GetSegmentOrigin() const {
+        return origin_;
+    }
+
+    const std::vector<Segment<N, D>, Alloc> &GetSegs() const {
         return segments_;
     }
 
+    // Apply transform to every key in GetValue(), the segments must be trained on transformed keys
+    void SetKeyTransform(KeyTransform<N> transform) {
+        transform_ = std::move(transform);
+    }
+
+    const KeyTransform<N> &GetKeyTransform() const {
+        return transform_;
+    }
+
+    // Strip prefix from string keys in KeyFromString(), the segments must be trained on stripped keys
+    void SetKeyPrefix(std::string prefix) {
+        key_prefix_ = std::move(prefix);
+    }
+
+    const std::string &GetKeyPrefix() const {
+        return key_prefix_;
+    }
+
+    // Convert a string key to N with the key prefix stripped
+    N KeyFromString(const std::string &key) const {
+        return stripPrefixToNumber<N>(key, key_prefix_);
+    }
+
+    // Same as GetValue(KeyFromString(key))
+    std::pair<N, N> GetValue(const std::string &key) const {
+        return GetValue(KeyFromString(key));
+    }
+
 // Return the range of the possible block
 // [lower bound, upper bound] (error-bound included)
 // with the key encoded as type N
 // [2,1] pair indicates its error (or all [l,r] s.t. r < l) is error or invalid.
-    std::pair<N, N> GetValue(N key) {
+    std::pair<N, N> GetValue(N key) const {
 //        std::cout << "Getting value of " << key << std::endl;
 //        assert(key >= segments_[0].x_start);
         if (segments_.empty()) {
             return std::pair<N, N>();
         }
+        key = transform_(key);
         auto comparator = [](const Segment<N, D> &s1, const Segment<N, D> &s2) {
             return s1.x_start < s2.x_start;
         };
-        auto it = std::lower_bound(segments_.begin(), segments_.end(), Segment<N, D>(key, 0, 0), comparator);
+        // The last segment with x_start <= key
+        auto it = std::upper_bound(segments_.begin(), segments_.end(), Segment<N, D>(key, 0, 0), comparator);
 //        if (it == segments_.end()) {
 //            return std::pair<N, N>(2, 1);
 //        }
@@ -443,12 +1035,39 @@ public:
             res = *(--it);
         }
 
-        auto tar = res.slope * key + res.y;
-        D lower_bound = floor(tar - gamma_);
-        D upper_bound = floor((tar + gamma_));
-        lower_bound = (lower_bound < 0) ? 0 : lower_bound;
-        upper_bound = (upper_bound < 0) ? 0 : upper_bound;
-        return std::pair<N, N>(round(lower_bound), round(upper_bound));
+        return predictionWindow<N, D>(segmentPrediction(res, key, origin_), gamma_);
+    }
+
+    // A model with error bound gamma and fewer segments, fitted to the predictions of this model without the keys
+    // New predictions are within gamma - GetGamma() of the old ones, so every new window contains the old window
+    // of each key from the first segment start on. A segment is linear over its keys, so only its first and last
+    // key are fed to a CLOSED_FORM GreedyPLR, as in BlockBoundaryPLR. The last segment covers every larger key,
+    // so it is kept as it is.
+    // Return a copy of this model if gamma <= GetGamma()
+    PLRDataRep Coarsen(D gamma) const {
+        if (gamma <= gamma_ || segments_.size() < 2) {
+            return *this;
+        }
+        GreedyPLR<N, D, Alloc> plr(shrunkGamma(gamma - gamma_), GREEDY_PLR_GAP_MODE::CLOSED_FORM, origin_,
+                                   segments_.get_allocator());
+        for (size_t i = 0; i + 1 < segments_.size(); i++) {
+            N first = segments_[i].x_start;
+            N next = segments_[i + 1].x_start;
+            if (next <= first) {
+                // Shadowed by the next segment
+                continue;
+            }
+            plr.process(first, segmentPrediction(segments_[i], first, origin_));
+            if (next - 1 != first) {
+                plr.process(next - 1, segmentPrediction(segments_[i], next - 1, origin_));
+            }
+        }
+        auto segments = plr.finish();
+        segments.push_back(segments_.back());
+        PLRDataRep model(gamma, std::move(segments), origin_);
+        model.transform_ = transform_;
+        model.key_prefix_ = key_prefix_;
+        return model;
     }
 
     // Debug only: print all data points using std::cout
@@ -467,8 +1086,35 @@ public:
 
 private:
     D gamma_;
-    std::vector<Segment<N, D>> segments_;
+    SEGMENT_ORIGIN origin_ = SEGMENT_ORIGIN::KEY_ZERO;
+    KeyTransform<N> transform_;
+    std::string key_prefix_;
+    std::vector<Segment<N, D>, Alloc> segments_;
 };
 
+// A segment sink which appends segments to an output stream in the PLRDataRep::Encode() format
+// The header (gamma, segment origin and key transform) is written on construction, so the stream content can be
+// decoded by PLRDataRep(encoded_str). The origin must be the one of the GreedyPLR the segments come from.
+// Pass it to GreedyPLR by std::ref() if the writer should outlive the model
+template<typename N, typename D>
+class SegmentStreamWriter {
+public:
+    SegmentStreamWriter(std::ostream &_os, D gamma, SEGMENT_ORIGIN origin = defaultSegmentOrigin<N>(),
+                        KeyTransform<N> transform = KeyTransform<N>()) : os(_os) {
+        // A model without segments encodes to its header alone
+        PLRDataRep<N, D> header(gamma, origin);
+        header.SetKeyTransform(std::move(transform));
+        os << header.Encode();
+    }
+
+    void operator()(const Segment<N, D> &seg) {
+        os << to_string<N>(seg.x_start);
+        os << to_string<D>(seg.slope);
+        os << to_string<D>(seg.y);
+    }
+
+private:
+    std::ostream &os;
+};
 
 #endif //PLR_LIBRARY_H
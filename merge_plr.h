@@ -0,0 +1,181 @@
+#include <vector>
+#include <algorithm>
+#include "library.h"
+
+#ifndef PLR_MERGE_PLR_H
+#define PLR_MERGE_PLR_H
+
+// One input of a model merge: a key -> block model of a sorted run, e.g. an SSTable being compacted
+// REQUIRED: model is trained with CLOSED_FORM gap handling on every key of the run, without a key transform,
+// the i-th key of the run is in block i / keys_per_block
+template<typename N, typename D>
+struct ModelMergeInput {
+    const PLRDataRep<N, D> *model;
+    N first_key;
+    N last_key;
+    size_t key_count;
+    D keys_per_block;
+};
+
+template<typename N, typename D>
+struct ModelMergeResult {
+    PLRDataRep<N, D> model;
+    size_t retrained_keys; // output keys fed to GreedyPLR, in the regions where the merge bound is too wide
+    D merge_bound; // the largest error bound of the summed input models, over the regions which are not retrained
+};
+
+// Merge the models of sorted runs into the model of their merged output, without training on every output key
+// The number of keys of a run up to a key is known from its model: with prediction p and error bound g, it is
+// within keys_per_block * (g + 1) - 1/2 of keys_per_block * p + 1/2 (the extra block is the gap between two keys,
+// where the model is within g of the line between their blocks). Below the first key of a run the count is 0
+// and from its last key on it is key_count. The output block of a key is (sum of the counts - 1) / keys_per_block
+// rounded down, so the summed predictions give a model whose bound is the sum of the bounds of the runs
+// overlapping the key, over the output keys_per_block.
+// The key range is cut into regions at the first and the last key of every run, so the bound is constant in a
+// region. Where it is below gamma, the summed predictions (linear between the segment starts of the runs) are
+// fitted by a CLOSED_FORM GreedyPLR within the rest of gamma, as in PLRDataRep::Coarsen(). Elsewhere, the region
+// is retrained from its output keys.
+// GetValue() of the model holds for every output key and, as with CLOSED_FORM training, for every key between
+// two output keys, with the block of the smaller one.
+template<typename N, typename D>
+class ModelMerger {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    ModelMerger(D _gamma, D _keys_per_block, SEGMENT_ORIGIN _segment_origin = defaultSegmentOrigin<N>())
+            : gamma(_gamma), keys_per_block(_keys_per_block), segment_origin(_segment_origin) {}
+
+    // Merge the input models, keys and blocks are the merged output, only read in the retrained regions
+    // REQUIRED: the inputs have no key in common and every input key is in the output, keys are sorted,
+    // the i-th output key is in block blocks[i] = i / keys_per_block
+    template<typename P>
+    ModelMergeResult<N, D> merge(const std::vector<ModelMergeInput<N, D>> &inputs, const N *keys, const P *blocks,
+                                 size_t count) {
+        std::vector<N> bounds;
+        for (auto &input: inputs) {
+            assert(input.model->GetKeyTransform().IsIdentity());
+            bounds.push_back(input.first_key);
+            bounds.push_back(input.last_key);
+        }
+        std::sort(bounds.begin(), bounds.end());
+        bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+        std::vector<Segment<N, D>> segments;
+        size_t retrained_keys = 0;
+        D merge_bound = 0;
+        for (size_t r = 0; r < bounds.size(); r++) {
+            bool last = (r + 1 == bounds.size());
+            N lo = bounds[r];
+            N hi = last ? lo : bounds[r + 1];
+            D bound = regionBound_(inputs, lo);
+            std::vector<Segment<N, D>> region;
+            if (bound < gamma) {
+                region = fitRegion_(inputs, lo, hi, last, shrunkGamma(gamma - bound));
+                merge_bound = std::max(merge_bound, bound);
+            } else {
+                region = retrainRegion_(lo, hi, keys, blocks, count, retrained_keys);
+            }
+            segments.insert(segments.end(), region.begin(), region.end());
+        }
+        return ModelMergeResult<N, D>{PLRDataRep<N, D>(gamma, std::move(segments), segment_origin), retrained_keys,
+                                      merge_bound};
+    }
+
+private:
+    D gamma;
+    D keys_per_block;
+    SEGMENT_ORIGIN segment_origin;
+
+    static bool active_(const ModelMergeInput<N, D> &input, N key) {
+        return input.first_key <= key && key < input.last_key;
+    }
+
+    // The bound of the summed predictions over the region starting at lo
+    D regionBound_(const std::vector<ModelMergeInput<N, D>> &inputs, N lo) const {
+        D bound = 0;
+        for (auto &input: inputs) {
+            if (active_(input, lo)) {
+                bound += input.keys_per_block * (input.model->GetGamma() + 1) - static_cast<D>(0.5);
+            }
+        }
+        return bound / keys_per_block;
+    }
+
+    // The output block of key from the summed predictions, before rounding down
+    // cursors[j] is the segment of input j used for the previous key, keys are passed in increasing order
+    D predict_(const std::vector<ModelMergeInput<N, D>> &inputs, N key, std::vector<size_t> &cursors) const {
+        D keys_up_to = 0;
+        for (size_t j = 0; j < inputs.size(); j++) {
+            auto &input = inputs[j];
+            if (key >= input.last_key) {
+                keys_up_to += static_cast<D>(input.key_count);
+            } else if (key >= input.first_key) {
+                auto &segs = input.model->GetSegs();
+                while (cursors[j] + 1 < segs.size() && segs[cursors[j] + 1].x_start <= key) {
+                    cursors[j]++;
+                }
+                D p = segmentPrediction(segs[cursors[j]], key, input.model->GetSegmentOrigin());
+                keys_up_to += input.keys_per_block * p + static_cast<D>(0.5);
+            }
+        }
+        return (keys_up_to - 1) / keys_per_block;
+    }
+
+    // Fit the summed predictions over [lo, hi), or over the single key lo for the last region
+    std::vector<Segment<N, D>> fitRegion_(const std::vector<ModelMergeInput<N, D>> &inputs, N lo, N hi, bool last,
+                                          D tolerance) const {
+        GreedyPLR<N, D> plr(tolerance, GREEDY_PLR_GAP_MODE::CLOSED_FORM, segment_origin);
+        std::vector<size_t> cursors(inputs.size(), 0);
+        if (last) {
+            plr.process(lo, predict_(inputs, lo, cursors));
+            return plr.finish();
+        }
+        // Every prediction is linear between two segment starts of the active inputs
+        std::vector<N> starts{lo};
+        for (auto &input: inputs) {
+            if (!active_(input, lo)) {
+                continue;
+            }
+            for (auto &seg: input.model->GetSegs()) {
+                if (seg.x_start > lo && seg.x_start < hi) {
+                    starts.push_back(seg.x_start);
+                }
+            }
+        }
+        std::sort(starts.begin(), starts.end());
+        starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+        for (size_t i = 0; i < starts.size(); i++) {
+            N end = (i + 1 < starts.size() ? starts[i + 1] : hi) - 1;
+            plr.process(starts[i], predict_(inputs, starts[i], cursors));
+            if (end != starts[i]) {
+                plr.process(end, predict_(inputs, end, cursors));
+            }
+        }
+        return plr.finish();
+    }
+
+    // Train over the output keys in [lo, hi), or in [lo, +inf) for the last region
+    // The block of the key before lo starts the region and the block of its last key ends it, so the keys
+    // between two output keys keep their window across regions.
+    template<typename P>
+    std::vector<Segment<N, D>> retrainRegion_(N lo, N hi, const N *keys, const P *blocks, size_t count,
+                                              size_t &retrained_keys) const {
+        bool last = (hi == lo);
+        size_t begin = std::lower_bound(keys, keys + count, lo) - keys;
+        size_t end = last ? count : std::lower_bound(keys, keys + count, hi) - keys;
+        GreedyPLR<N, D> plr(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM, segment_origin);
+        if (begin > 0 && (begin == end || keys[begin] > lo)) {
+            plr.process(lo, static_cast<D>(blocks[begin - 1]));
+        }
+        for (size_t i = begin; i < end; i++) {
+            plr.process(keys[i], static_cast<D>(blocks[i]));
+        }
+        if (!last && end > 0 && keys[end - 1] < hi - 1) {
+            plr.process(hi - 1, static_cast<D>(blocks[end - 1]));
+        }
+        retrained_keys += end - begin;
+        return plr.finish();
+    }
+};
+
+#endif //PLR_MERGE_PLR_H
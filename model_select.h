@@ -0,0 +1,200 @@
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include "library.h"
+
+#ifndef PLR_MODEL_SELECT_H
+#define PLR_MODEL_SELECT_H
+
+// The kinds of key -> block index a table can store
+enum BLOCK_INDEX {
+    PLR_INDEX = 0, // a GreedyPLR model
+    FENCE_POINTER_INDEX, // the first key of every block, searched by binary search
+    LINEAR_INDEX // a single line over the whole table, its gamma is its largest error
+};
+
+// A key -> block index of any BLOCK_INDEX kind, with the same GetValue() contract as PLRDataRep
+// Fence pointers return the exact block ([block, block]) of every key.
+template<typename N, typename D>
+class BlockIndex {
+public:
+    // PLR_INDEX or LINEAR_INDEX
+    BlockIndex(BLOCK_INDEX kind, PLRDataRep<N, D> model) : kind_(kind), model_(std::move(model)) {}
+
+    // FENCE_POINTER_INDEX, first_keys[b] is the first key of block b
+    explicit BlockIndex(std::vector<N> first_keys)
+            : kind_(BLOCK_INDEX::FENCE_POINTER_INDEX), model_(0), fences_(std::move(first_keys)) {}
+
+    // REQUIRED: String must be encoded from Encode() function.
+    BlockIndex(const std::string &encoded_str) : model_(0) {
+        Decode(encoded_str);
+    }
+
+    // Encoding: uint8_t kind, then PLRDataRep::Encode() for a model or every first key for fence pointers
+    std::string Encode() const {
+        std::stringstream ss;
+        ss << to_string<uint8_t>(kind_);
+        if (kind_ == BLOCK_INDEX::FENCE_POINTER_INDEX) {
+            for (auto key: fences_) {
+                ss << to_string<N>(key);
+            }
+        } else {
+            PLRDataRep<N, D> model = model_;
+            ss << model.Encode();
+        }
+        return ss.str();
+    }
+
+    void Decode(const std::string &encoded_str) {
+        kind_ = static_cast<BLOCK_INDEX>(to_type<uint8_t>(encoded_str.substr(0, 1)));
+        fences_.clear();
+        if (kind_ != BLOCK_INDEX::FENCE_POINTER_INDEX) {
+            model_ = PLRDataRep<N, D>(encoded_str.substr(1));
+            return;
+        }
+        assert((encoded_str.size() - 1) % sizeof(N) == 0);
+        fences_.reserve((encoded_str.size() - 1) / sizeof(N));
+        for (size_t ptr = 1; ptr < encoded_str.size(); ptr += sizeof(N)) {
+            fences_.push_back(to_type<N>(encoded_str.substr(ptr, sizeof(N))));
+        }
+    }
+
+    BLOCK_INDEX GetKind() const {
+        return kind_;
+    }
+
+    // REQUIRED: GetKind() is not FENCE_POINTER_INDEX
+    const PLRDataRep<N, D> &GetModel() const {
+        return model_;
+    }
+
+    // Return the range of the possible block
+    // [lower bound, upper bound] (error-bound included)
+    std::pair<N, N> GetValue(N key) const {
+        if (kind_ != BLOCK_INDEX::FENCE_POINTER_INDEX) {
+            return model_.GetValue(key);
+        }
+        // The last block whose first key is <= key
+        auto it = std::upper_bound(fences_.begin(), fences_.end(), key);
+        N block = (it == fences_.begin()) ? 0 : static_cast<N>(it - fences_.begin() - 1);
+        return std::pair<N, N>(block, block);
+    }
+
+private:
+    BLOCK_INDEX kind_;
+    PLRDataRep<N, D> model_;
+    std::vector<N> fences_;
+};
+
+// Weights of the selection cost: cost = lookup_cost + byte_cost * bytes
+struct BlockIndexCosts {
+    double compare_cost = 10; // one step of a binary search over the index (segments or fence keys), a cache miss
+    double block_cost = 20; // one block of the GetValue() window to read and search
+    double byte_cost = 0.00001; // one byte of index kept in memory
+};
+
+// The estimated costs of one candidate index
+template<typename D>
+struct BlockIndexCandidate {
+    BLOCK_INDEX kind;
+    D gamma; // 0 for fence pointers
+    size_t bytes; // size of BlockIndex::Encode()
+    double lookup_cost; // binary search steps and window blocks, weighted
+    double cost; // lookup_cost + byte_cost * bytes
+};
+
+template<typename N, typename D>
+struct BlockIndexSelection {
+    BlockIndex<N, D> index; // the cheapest candidate
+    std::vector<BlockIndexCandidate<D>> candidates; // every candidate, in the order they were built
+};
+
+// Build-time choice of the cheapest index of a table
+// Every candidate is built from the keys: a CLOSED_FORM GreedyPLR model at each gamma, fence pointers and a
+// single line. A lookup is estimated as a binary search over the index (log2 of its entries) and a read of the
+// average window, 2 * gamma + 1 blocks, and the candidate with the lowest lookup cost plus weighted bytes is kept.
+// The line runs from the first to the last key, shifted to the middle of its errors, and its gamma is the
+// largest error, so small or nearly uniform tables get a one-segment model without a gamma to tune.
+template<typename N, typename D>
+class BlockIndexSelector {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    BlockIndexSelector(std::vector<D> _gammas = {0.5, 2, 8}, BlockIndexCosts _costs = BlockIndexCosts())
+            : gammas(std::move(_gammas)), costs(_costs) {}
+
+    // Select over sorted keys, the i-th key is in block blocks[i]
+    // REQUIRED: keys are sorted, blocks are non-decreasing, count > 0
+    template<typename P>
+    BlockIndexSelection<N, D> select(const N *keys, const P *blocks, size_t count) {
+        std::vector<BlockIndex<N, D>> indexes;
+        std::vector<BlockIndexCandidate<D>> candidates;
+        for (auto gamma: gammas) {
+            PLRDataRep<N, D> model(gamma, GreedyPLR<N, D>(gamma, GREEDY_PLR_GAP_MODE::CLOSED_FORM)
+                    .train(keys, blocks, count));
+            size_t segments = model.GetSegs().size();
+            indexes.emplace_back(BLOCK_INDEX::PLR_INDEX, std::move(model));
+            candidates.push_back(candidate_(BLOCK_INDEX::PLR_INDEX, gamma, segments, indexes.back().Encode().size()));
+        }
+
+        std::vector<N> fences;
+        for (size_t i = 0; i < count; i++) {
+            if (i == 0 || blocks[i] != blocks[i - 1]) {
+                fences.push_back(keys[i]);
+            }
+        }
+        // An exact block, found among every first key
+        size_t fence_count = fences.size();
+        indexes.emplace_back(std::move(fences));
+        candidates.push_back(candidate_(BLOCK_INDEX::FENCE_POINTER_INDEX, 0, fence_count,
+                                        indexes.back().Encode().size()));
+
+        auto line = line_(keys, blocks, count);
+        D line_gamma = line.GetGamma();
+        indexes.emplace_back(BLOCK_INDEX::LINEAR_INDEX, std::move(line));
+        candidates.push_back(candidate_(BLOCK_INDEX::LINEAR_INDEX, line_gamma, 1, indexes.back().Encode().size()));
+
+        size_t best = 0;
+        for (size_t i = 1; i < candidates.size(); i++) {
+            if (candidates[i].cost < candidates[best].cost) {
+                best = i;
+            }
+        }
+        return BlockIndexSelection<N, D>{std::move(indexes[best]), std::move(candidates)};
+    }
+
+private:
+    std::vector<D> gammas;
+    BlockIndexCosts costs;
+
+    // A candidate searching entries, with a window of 2 * gamma + 1 blocks on average
+    BlockIndexCandidate<D> candidate_(BLOCK_INDEX kind, D gamma, size_t entries, size_t bytes) const {
+        double lookup_cost = costs.compare_cost * std::log2(static_cast<double>(std::max<size_t>(1, entries))) +
+                             costs.block_cost * (2 * static_cast<double>(gamma) + 1);
+        return BlockIndexCandidate<D>{kind, gamma, bytes, lookup_cost,
+                                      lookup_cost + costs.byte_cost * static_cast<double>(bytes)};
+    }
+
+    // One segment anchored at the first key, through the middle of the errors of the line to the last key
+    template<typename P>
+    PLRDataRep<N, D> line_(const N *keys, const P *blocks, size_t count) const {
+        D span = keyOffset<N, D>(keys[count - 1], keys[0]);
+        D rise = static_cast<D>(blocks[count - 1]) - static_cast<D>(blocks[0]);
+        D slope = (span > 0) ? rise / span : 0;
+        D lo = 0;
+        D hi = 0;
+        for (size_t i = 0; i < count; i++) {
+            D error = static_cast<D>(blocks[i]) - static_cast<D>(blocks[0]) - slope * keyOffset<N, D>(keys[i], keys[0]);
+            lo = std::min(lo, error);
+            hi = std::max(hi, error);
+        }
+        D gamma = widenedGamma<D>(0, (hi - lo) / 2);
+        std::vector<Segment<N, D>> segments{Segment<N, D>(keys[0], slope, static_cast<D>(blocks[0]) + (lo + hi) / 2)};
+        return PLRDataRep<N, D>(gamma, std::move(segments), SEGMENT_ORIGIN::SEGMENT_START);
+    }
+};
+
+#endif //PLR_MODEL_SELECT_H
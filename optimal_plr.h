@@ -0,0 +1,152 @@
+#include <deque>
+#include <vector>
+#include "library.h"
+
+#ifndef PLR_OPTIMAL_PLR_H
+#define PLR_OPTIMAL_PLR_H
+
+// Optimal PLR Model (Xie et al. 2014, Section 4)
+// Unlike GreedyPLR, the extreme lines rho_lower/rho_upper are not pinned to a fixed intersection point.
+// Every new point rotates them around the tangent point of a convex hull:
+// upper_hull is the lower convex chain of the upper bound points (pt.y + gamma),
+// lower_hull is the upper convex chain of the lower bound points (pt.y - gamma).
+// A segment only ends when no line can pass within gamma of all of its points,
+// so the number of segments is minimal for the error bound. Each point is pushed and popped from a hull
+// at most once, so processing is amortized O(1) per point.
+template<typename N, typename D>
+class OptimalPLR {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    // The extreme lines touch the bound points exactly, so training uses shrunkGamma()
+    OptimalPLR(D _gamma) : state(GREEDY_PLR_STATE::NEED_2_PT), gamma(shrunkGamma(_gamma)), last_pt() {}
+
+    // Process a point
+    // Return if pt.x <= the last processed x
+    // REQUIRED: The PLR Model is not at the finishing state
+    void process(Point<double> pt) {
+        assert(state != GREEDY_PLR_STATE::FINISHED);
+        if (dp_count != 0 && pt.x <= last_pt.x) {
+            return;
+        }
+        switch (state) {
+            case GREEDY_PLR_STATE::NEED_2_PT:
+                s0 = pt;
+                state = GREEDY_PLR_STATE::NEED_1_PT;
+                break;
+            case GREEDY_PLR_STATE::NEED_1_PT:
+                s1 = pt;
+                setup_();
+                state = GREEDY_PLR_STATE::READY;
+                break;
+            case GREEDY_PLR_STATE::READY:
+                process_(pt);
+                break;
+            default:
+                assert(false); // non-reachable code, suppress warning
+        }
+        last_pt = pt;
+        dp_count++;
+    }
+
+    // Finish the PLR Model
+    // REQUIRED: Has not been called finish()
+    std::vector<Segment<N, D>> finish() {
+        assert(state != GREEDY_PLR_STATE::FINISHED);
+        switch (state) {
+            case GREEDY_PLR_STATE::NEED_2_PT:
+                break;
+            case GREEDY_PLR_STATE::NEED_1_PT:
+                processed_segments.push_back(Segment<N, D>{static_cast<N>(s0.x), 0, s0.y});
+                break;
+            case GREEDY_PLR_STATE::READY:
+                processed_segments.push_back(current_segment());
+                break;
+            default:
+                assert(false); // Unreachable code, suppress warning
+        }
+        state = GREEDY_PLR_STATE::FINISHED;
+        return processed_segments;
+    }
+
+private:
+    GREEDY_PLR_STATE state;
+    D gamma;
+    Point<D> last_pt;
+    Point<D> s0;
+    Point<D> s1;
+    Line<D> rho_lower;
+    Line<D> rho_upper;
+    std::deque<Point<D>> upper_hull;
+    std::deque<Point<D>> lower_hull;
+    std::vector<Segment<N, D>> processed_segments;
+    size_t dp_count = 0;
+
+    static D slope_(Point<D> a, Point<D> b) {
+        return (b.y - a.y) / (b.x - a.x);
+    }
+
+    // > 0 if a -> b -> c turns counter-clockwise
+    static D cross_(Point<D> a, Point<D> b, Point<D> c) {
+        return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    }
+
+    void setup_() {
+        this->rho_lower = Line<D>(s0.getUpperBound(gamma), s1.getLowerBound(gamma));
+        this->rho_upper = Line<D>(s0.getLowerBound(gamma), s1.getUpperBound(gamma));
+        upper_hull.assign({s0.getUpperBound(gamma), s1.getUpperBound(gamma)});
+        lower_hull.assign({s0.getLowerBound(gamma), s1.getLowerBound(gamma)});
+    }
+
+    // Any line between rho_lower and rho_upper (in slope/intercept space) is within gamma of the segment,
+    // use the average of the two extreme lines
+    Segment<N, D> current_segment() {
+        N segment_start = s0.x;
+        D avg_slope = (rho_upper.a1 + rho_lower.a1) / 2;
+        D intercept = (rho_upper.a2 + rho_lower.a2) / 2;
+        return Segment<N, D>{segment_start, avg_slope, intercept};
+    }
+
+    void process_(Point<D> pt) {
+        auto s_upper = pt.getUpperBound(gamma);
+        auto s_lower = pt.getLowerBound(gamma);
+        if (rho_lower.below(s_upper) || rho_upper.above(s_lower)) {
+            // No line passes within gamma of all points, start a new segment from pt
+            processed_segments.push_back(current_segment());
+            s0 = pt;
+            state = GREEDY_PLR_STATE::NEED_1_PT;
+            return;
+        }
+
+        if (rho_upper.below(s_upper)) {
+            // Rotate rho_upper to the tangent from s_upper to lower_hull (minimum slope)
+            size_t i = 0;
+            while (i + 1 < lower_hull.size() && slope_(lower_hull[i + 1], s_upper) <= slope_(lower_hull[i], s_upper)) {
+                i++;
+            }
+            rho_upper = Line<D>(lower_hull[i], s_upper);
+            lower_hull.erase(lower_hull.begin(), lower_hull.begin() + i);
+        }
+        if (rho_lower.above(s_lower)) {
+            // Rotate rho_lower to the tangent from s_lower to upper_hull (maximum slope)
+            size_t i = 0;
+            while (i + 1 < upper_hull.size() && slope_(upper_hull[i + 1], s_lower) >= slope_(upper_hull[i], s_lower)) {
+                i++;
+            }
+            rho_lower = Line<D>(upper_hull[i], s_lower);
+            upper_hull.erase(upper_hull.begin(), upper_hull.begin() + i);
+        }
+
+        // upper_hull keeps counter-clockwise turns, lower_hull keeps clockwise turns
+        while (upper_hull.size() >= 2 && cross_(upper_hull[upper_hull.size() - 2], upper_hull.back(), s_upper) <= 0) {
+            upper_hull.pop_back();
+        }
+        upper_hull.push_back(s_upper);
+        while (lower_hull.size() >= 2 && cross_(lower_hull[lower_hull.size() - 2], lower_hull.back(), s_lower) >= 0) {
+            lower_hull.pop_back();
+        }
+        lower_hull.push_back(s_lower);
+    }
+};
+
+#endif //PLR_OPTIMAL_PLR_H
@@ -0,0 +1,117 @@
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "library.h"
+
+#ifndef PLR_PARALLEL_PLR_H
+#define PLR_PARALLEL_PLR_H
+
+// Partitioned PLR training
+// The sorted input is split into one chunk per thread, and every chunk is trained by its own GreedyPLR.
+// Chunk results are then stitched: at each boundary the last segment of the left chunk and the first segment
+// of the right chunk are retrained together over their keys, which usually merges them into one segment.
+// Every key is still covered by a segment trained over it, so the error bound gamma holds everywhere.
+// The segment count is usually within one segment per boundary of the serial count.
+template<typename N, typename D>
+class ParallelPLR {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    ParallelPLR(D _gamma, size_t _threads = std::thread::hardware_concurrency(),
+                GREEDY_PLR_GAP_MODE _gap_mode = GREEDY_PLR_GAP_MODE::CLOSED_FORM,
+                SEGMENT_ORIGIN _segment_origin = defaultSegmentOrigin<N>())
+            : gamma(_gamma), threads(std::max<size_t>(1, _threads)), gap_mode(_gap_mode),
+              segment_origin(_segment_origin) {}
+
+    // Train over a sorted array of keys and their positions (or block ids)
+    // REQUIRED: keys are sorted
+    template<typename P>
+    PLRDataRep<N, D> train(const N *keys, const P *positions, size_t count) {
+        return train_(keys, count, [this, keys, positions](size_t lo, size_t hi) {
+            return GreedyPLR<N, D>(gamma, gap_mode, segment_origin).train(keys + lo, positions + lo, hi - lo);
+        });
+    }
+
+    // Train over a sorted array of keys, the i-th key has position first_position + i
+    // REQUIRED: keys are sorted
+    PLRDataRep<N, D> train(const N *keys, size_t count, D first_position = 0) {
+        return train_(keys, count, [this, keys, first_position](size_t lo, size_t hi) {
+            return GreedyPLR<N, D>(gamma, gap_mode, segment_origin).train(keys + lo, hi - lo, first_position + static_cast<D>(lo));
+        });
+    }
+
+private:
+    D gamma;
+    size_t threads;
+    GREEDY_PLR_GAP_MODE gap_mode;
+    SEGMENT_ORIGIN segment_origin;
+
+    // trainRange(lo, hi) trains a fresh GreedyPLR over keys[lo, hi)
+    template<typename TrainFn>
+    PLRDataRep<N, D> train_(const N *keys, size_t count, TrainFn trainRange) {
+        auto bounds = partition_(keys, count);
+        size_t chunks = bounds.size() - 1;
+        std::vector<std::vector<Segment<N, D>>> results(chunks);
+        std::vector<std::thread> workers;
+        for (size_t c = 1; c < chunks; c++) {
+            workers.emplace_back([&results, &bounds, &trainRange, c]() {
+                results[c] = trainRange(bounds[c], bounds[c + 1]);
+            });
+        }
+        results[0] = trainRange(bounds[0], bounds[1]);
+        for (auto &worker: workers) {
+            worker.join();
+        }
+
+        std::vector<Segment<N, D>> segments = std::move(results[0]);
+        for (size_t c = 1; c < chunks; c++) {
+            stitch_(keys, bounds[c - 1], bounds[c + 1], segments, results[c], trainRange);
+        }
+        return PLRDataRep<N, D>(gamma, std::move(segments), segment_origin);
+    }
+
+    // Chunk boundaries, a run of equal keys is never split across two chunks
+    std::vector<size_t> partition_(const N *keys, size_t count) {
+        size_t chunks = std::max<size_t>(1, std::min(threads, count / 2));
+        std::vector<size_t> bounds{0};
+        for (size_t c = 1; c < chunks; c++) {
+            size_t bound = std::max(bounds.back(), count * c / chunks);
+            while (bound > 0 && bound < count && keys[bound] == keys[bound - 1]) {
+                bound++;
+            }
+            if (bound > bounds.back() && bound < count) {
+                bounds.push_back(bound);
+            }
+        }
+        bounds.push_back(count);
+        return bounds;
+    }
+
+    // Append the segments of the next chunk, retraining the segments that meet at the boundary
+    // Retraining never reaches back before left_start (the start of the left chunk), so the stitching work
+    // stays linear even when one segment spans many chunks; such a segment is kept and truncated instead.
+    // chunk_end is the end of the next chunk in keys
+    template<typename TrainFn>
+    void stitch_(const N *keys, size_t left_start, size_t chunk_end, std::vector<Segment<N, D>> &segments,
+                 const std::vector<Segment<N, D>> &next, TrainFn &trainRange) {
+        if (next.empty()) {
+            return;
+        }
+        if (segments.empty()) {
+            segments = next;
+            return;
+        }
+        size_t lo = std::lower_bound(keys, keys + chunk_end, segments.back().x_start) - keys;
+        size_t hi = (next.size() > 1) ? std::lower_bound(keys, keys + chunk_end, next[1].x_start) - keys : chunk_end;
+        if (lo < left_start) {
+            lo = left_start;
+        } else {
+            segments.pop_back();
+        }
+        auto merged = trainRange(lo, hi);
+        segments.insert(segments.end(), merged.begin(), merged.end());
+        segments.insert(segments.end(), next.begin() + 1, next.end());
+    }
+};
+
+#endif //PLR_PARALLEL_PLR_H
@@ -0,0 +1,112 @@
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include "library.h"
+
+#ifndef PLR_PLR_ARENA_H
+#define PLR_PLR_ARENA_H
+
+// A monotonic arena for building many small models, e.g. all the models of one L0 flush
+// Allocation bumps a pointer inside a chunk, deallocation is a no-op, and all the memory is handed back
+// at once by Reset() (chunks are kept for reuse) or by destroying the arena.
+// REQUIRED: The arena outlives every container allocated from it. Not thread-safe.
+class PLRArena {
+public:
+    explicit PLRArena(size_t _chunk_size = 64 * 1024) : chunk_size(_chunk_size) {}
+
+    PLRArena(const PLRArena &) = delete;
+
+    PLRArena &operator=(const PLRArena &) = delete;
+
+    void *Allocate(size_t bytes, size_t alignment) {
+        while (current < chunks.size()) {
+            size_t aligned = (offset + alignment - 1) / alignment * alignment;
+            if (aligned + bytes <= chunks[current].size) {
+                offset = aligned + bytes;
+                used += bytes;
+                return chunks[current].data.get() + aligned;
+            }
+            // Move on to the next kept chunk
+            current++;
+            offset = 0;
+        }
+        size_t size = std::max(chunk_size, bytes + alignment);
+        chunks.push_back(Chunk{std::unique_ptr<char[]>(new char[size]), size});
+        current = chunks.size() - 1;
+        offset = 0;
+        return Allocate(bytes, alignment);
+    }
+
+    // Release every allocation, keeping the chunks for reuse
+    void Reset() {
+        current = 0;
+        offset = 0;
+        used = 0;
+    }
+
+    size_t BytesUsed() const {
+        return used;
+    }
+
+    size_t BytesReserved() const {
+        size_t total = 0;
+        for (auto &chunk: chunks) {
+            total += chunk.size;
+        }
+        return total;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    size_t chunk_size;
+    std::vector<Chunk> chunks;
+    size_t current = 0;
+    size_t offset = 0;
+    size_t used = 0;
+};
+
+// A standard allocator allocating from a PLRArena
+template<typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    ArenaAllocator(PLRArena &_arena) : arena(&_arena) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &another) : arena(another.arena) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(arena->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t) {}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U> &another) const {
+        return arena == another.arena;
+    }
+
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U> &another) const {
+        return arena != another.arena;
+    }
+
+private:
+    template<typename U> friend class ArenaAllocator;
+
+    PLRArena *arena;
+};
+
+template<typename N, typename D>
+using ArenaGreedyPLR = GreedyPLR<N, D, ArenaAllocator<Segment<N, D>>>;
+
+template<typename N, typename D>
+using ArenaPLRDataRep = PLRDataRep<N, D, ArenaAllocator<Segment<N, D>>>;
+
+#endif //PLR_PLR_ARENA_H
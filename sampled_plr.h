@@ -0,0 +1,97 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "library.h"
+
+#ifndef PLR_SAMPLED_PLR_H
+#define PLR_SAMPLED_PLR_H
+
+// Which keys SampledPLR trains on
+enum SAMPLING_MODE {
+    EVERY_KTH_KEY = 0, // keys 0, k, 2k, ...
+    FIRST_KEY_PER_BLOCK // the first key of every k-th block (position)
+};
+
+template<typename N, typename D>
+struct SampledTrainResult {
+    PLRDataRep<N, D> model; // gamma widened to cover every key
+    size_t sampled_keys; // keys fed to the trainer, including the last key
+    D max_error; // largest |prediction - position| measured over all keys
+    D gamma_loss; // model.GetGamma() - the requested gamma
+};
+
+// Sampled PLR training
+// Only a sample of the keys is fed to GreedyPLR, so the trainer work scales with the sample size.
+// The model is then checked against every key with one sequential pass (a multiply-add per key), and its gamma
+// is widened to the largest error measured on the skipped keys, so GetValue() still returns a window containing
+// the position of every key. The last key is always sampled, so the model covers the whole key range.
+template<typename N, typename D>
+class SampledPLR {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    SampledPLR(D _gamma, size_t _rate, SAMPLING_MODE _mode = SAMPLING_MODE::EVERY_KTH_KEY,
+               GREEDY_PLR_GAP_MODE _gap_mode = GREEDY_PLR_GAP_MODE::CLOSED_FORM,
+               SEGMENT_ORIGIN _segment_origin = defaultSegmentOrigin<N>())
+            : gamma(_gamma), rate(std::max<size_t>(1, _rate)), mode(_mode), gap_mode(_gap_mode),
+              segment_origin(_segment_origin) {}
+
+    // Train over a sorted array of keys and their positions (or block ids)
+    // REQUIRED: keys are sorted
+    template<typename P>
+    SampledTrainResult<N, D> train(const N *keys, const P *positions, size_t count) {
+        return train_(keys, count, [positions](size_t i) { return static_cast<D>(positions[i]); });
+    }
+
+    // Train over a sorted array of keys, the i-th key has position first_position + i
+    // Every key is its own block, so FIRST_KEY_PER_BLOCK samples like EVERY_KTH_KEY
+    // REQUIRED: keys are sorted
+    SampledTrainResult<N, D> train(const N *keys, size_t count, D first_position = 0) {
+        return train_(keys, count, [first_position](size_t i) { return first_position + static_cast<D>(i); });
+    }
+
+private:
+    D gamma;
+    size_t rate;
+    SAMPLING_MODE mode;
+    GREEDY_PLR_GAP_MODE gap_mode;
+    SEGMENT_ORIGIN segment_origin;
+
+    template<typename PositionFn>
+    SampledTrainResult<N, D> train_(const N *keys, size_t count, PositionFn position) {
+        std::vector<N> sample_keys;
+        std::vector<D> sample_positions;
+        auto take = [&](size_t i) {
+            sample_keys.push_back(keys[i]);
+            sample_positions.push_back(position(i));
+        };
+        if (mode == SAMPLING_MODE::EVERY_KTH_KEY) {
+            sample_keys.reserve(count / rate + 2);
+            sample_positions.reserve(count / rate + 2);
+            for (size_t i = 0; i < count; i += rate) {
+                take(i);
+            }
+        } else {
+            size_t blocks = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (i == 0 || position(i) != position(i - 1)) {
+                    if (blocks++ % rate == 0) {
+                        take(i);
+                    }
+                }
+            }
+        }
+        if (count > 0 && (sample_keys.empty() || sample_keys.back() != keys[count - 1])) {
+            take(count - 1);
+        }
+
+        auto segments = GreedyPLR<N, D>(gamma, gap_mode, segment_origin)
+                .train(sample_keys.data(), sample_positions.data(), sample_keys.size());
+        D max_error = maxSegmentError(segments, segment_origin, keys, count, position);
+        D model_gamma = widenedGamma(gamma, max_error);
+        return SampledTrainResult<N, D>{PLRDataRep<N, D>(model_gamma, std::move(segments), segment_origin),
+                                        sample_keys.size(), max_error, model_gamma - gamma};
+    }
+};
+
+#endif //PLR_SAMPLED_PLR_H
@@ -0,0 +1,138 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "library.h"
+
+#ifndef PLR_SOSD_LOADER_H
+#define PLR_SOSD_LOADER_H
+
+// A read-only memory mapping of a SOSD key file: a uint64_t key count, then the sorted keys as N
+// (uint64_t or uint32_t in the SOSD datasets)
+// The mapping is read sequentially, so the kernel reads ahead, and Train() hands back the pages it has read,
+// so files larger than memory can be trained on.
+template<typename N>
+class MappedKeyFile {
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    MappedKeyFile() = default;
+
+    explicit MappedKeyFile(const std::string &path) {
+        Open(path);
+    }
+
+    MappedKeyFile(const MappedKeyFile &) = delete;
+
+    MappedKeyFile &operator=(const MappedKeyFile &) = delete;
+
+    ~MappedKeyFile() {
+        Close();
+    }
+
+    // Map the file at path, closing the file mapped before
+    // Return false if the file cannot be mapped or its size does not match its key count
+    bool Open(const std::string &path) {
+        Close();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(uint64_t)) {
+            close(fd);
+            return false;
+        }
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps the file open
+        close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        madvise(addr, st.st_size, MADV_SEQUENTIAL);
+        uint64_t count;
+        memcpy(&count, addr, sizeof(count));
+        if (count != (st.st_size - sizeof(uint64_t)) / sizeof(N) ||
+            (st.st_size - sizeof(uint64_t)) % sizeof(N) != 0) {
+            munmap(addr, st.st_size);
+            return false;
+        }
+        mapping = static_cast<char *>(addr);
+        mapping_size = st.st_size;
+        key_count = count;
+        return true;
+    }
+
+    void Close() {
+        if (mapping != nullptr) {
+            munmap(mapping, mapping_size);
+        }
+        mapping = nullptr;
+        mapping_size = 0;
+        key_count = 0;
+    }
+
+    bool IsOpen() const {
+        return mapping != nullptr;
+    }
+
+    size_t GetKeyCount() const {
+        return key_count;
+    }
+
+    // The i-th key, read from the mapping
+    // REQUIRED: IsOpen(), i < GetKeyCount()
+    N GetKey(size_t i) const {
+        N key;
+        memcpy(&key, mapping + sizeof(uint64_t) + i * sizeof(N), sizeof(N));
+        return key;
+    }
+
+    // Hand back the pages of keys [0, end), they are read again from the file if used later
+    // REQUIRED: IsOpen()
+    void Release(size_t end) {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t bytes = (sizeof(uint64_t) + std::min(end, key_count) * sizeof(N)) / page * page;
+        if (bytes != 0) {
+            madvise(mapping, bytes, MADV_DONTNEED);
+        }
+    }
+
+    // Stream every key into plr, the i-th key in block i / keys_per_block, and finish it
+    // Repeated keys (SOSD files may have them) keep the block of their first occurrence. Pages are handed back
+    // every chunk_keys keys.
+    // REQUIRED: IsOpen(), no point has been processed by plr
+    template<typename D, typename Alloc>
+    std::vector<Segment<N, D>, Alloc> Train(GreedyPLR<N, D, Alloc> &plr, size_t keys_per_block = 1,
+                                            size_t chunk_keys = DEFAULT_CHUNK_KEYS) {
+        keys_per_block = std::max<size_t>(1, keys_per_block);
+        chunk_keys = std::max<size_t>(1, chunk_keys);
+        N last_key = 0;
+        for (size_t begin = 0; begin < key_count; begin += chunk_keys) {
+            size_t end = std::min(key_count, begin + chunk_keys);
+            for (size_t i = begin; i < end; i++) {
+                N key = GetKey(i);
+                if (i != 0 && key == last_key) {
+                    continue;
+                }
+                plr.process(key, static_cast<D>(i / keys_per_block));
+                last_key = key;
+            }
+            Release(end);
+        }
+        return plr.finish();
+    }
+
+private:
+    static constexpr size_t DEFAULT_CHUNK_KEYS = 1 << 20;
+
+    char *mapping = nullptr;
+    size_t mapping_size = 0;
+    size_t key_count = 0;
+};
+
+#endif //PLR_SOSD_LOADER_H
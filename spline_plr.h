@@ -0,0 +1,187 @@
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include "library.h"
+
+#ifndef PLR_SPLINE_PLR_H
+#define PLR_SPLINE_PLR_H
+
+// A knot of a connected piecewise linear spline
+template<typename N, typename D>
+struct __attribute__((packed)) Knot {
+    N x;
+    D y;
+
+    Knot() = default;
+
+    Knot(N _x, D _y) : x(_x), y(_y) {}
+
+    bool operator==(const Knot<N, D> &other) const {
+        return x == other.x && y == other.y;
+    }
+};
+
+// Greedy spline corridor (Neumann and Michel 2008, as used by RadixSpline)
+// Every knot is a data point, and consecutive knots are joined by a line, so only the knots are stored.
+// From the last knot, the corridor is the range of slopes which pass within gamma of every point since that knot.
+// When a point falls outside the corridor, the previous point becomes a knot: the line to it lies inside
+// the corridor, so every point in between is within gamma.
+// All slopes are computed on exact key offsets from the last knot.
+template<typename N, typename D>
+class GreedySpline {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    // The corridor touches the bound points exactly, so training uses shrunkGamma()
+    GreedySpline(D _gamma) : gamma(shrunkGamma(_gamma)) {}
+
+    // Process a key and its position
+    // Return if key <= the last processed key
+    // REQUIRED: Has not been called finish()
+    void process(N key, D y) {
+        assert(!finished);
+        if (count != 0 && key <= last.x) {
+            return;
+        }
+        if (count == 0) {
+            knots.emplace_back(key, y);
+        } else if (count == 1) {
+            reset_(key, y);
+        } else {
+            D dx = keyOffset<N, D>(key, knots.back().x);
+            D slope = (y - knots.back().y) / dx;
+            if (slope < lower || slope > upper) {
+                knots.push_back(last);
+                reset_(key, y);
+            } else {
+                upper = std::min(upper, (y + gamma - knots.back().y) / dx);
+                lower = std::max(lower, (y - gamma - knots.back().y) / dx);
+            }
+        }
+        last = Knot<N, D>(key, y);
+        count++;
+    }
+
+    // Train over a sorted array of keys and their positions (or block ids)
+    // REQUIRED: keys are sorted, no point has been processed
+    template<typename P>
+    std::vector<Knot<N, D>> train(const N *keys, const P *positions, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            process(keys[i], static_cast<D>(positions[i]));
+        }
+        return finish();
+    }
+
+    // Train over a sorted array of keys, the i-th key has position first_position + i
+    // REQUIRED: keys are sorted, no point has been processed
+    std::vector<Knot<N, D>> train(const N *keys, size_t n, D first_position = 0) {
+        for (size_t i = 0; i < n; i++) {
+            process(keys[i], first_position + static_cast<D>(i));
+        }
+        return finish();
+    }
+
+    // Finish the spline
+    // REQUIRED: Has not been called finish()
+    std::vector<Knot<N, D>> finish() {
+        assert(!finished);
+        finished = true;
+        if (count > 1) {
+            knots.push_back(last);
+        }
+        return std::move(knots);
+    }
+
+private:
+    D gamma;
+    std::vector<Knot<N, D>> knots;
+    Knot<N, D> last;
+    D lower = 0;
+    D upper = 0;
+    size_t count = 0;
+    bool finished = false;
+
+    // Start the corridor from the last knot through the bounds of (key, y)
+    void reset_(N key, D y) {
+        D dx = keyOffset<N, D>(key, knots.back().x);
+        upper = (y + gamma - knots.back().y) / dx;
+        lower = (y - gamma - knots.back().y) / dx;
+    }
+};
+
+// A trained connected spline model, with the same GetValue() contract as PLRDataRep
+// Keys below the first knot or above the last one are predicted at the nearest knot.
+// Encoding: gamma, then every knot as x, y
+template<typename N, typename D>
+class SplinePLRDataRep {
+public:
+    SplinePLRDataRep(D gamma, std::vector<Knot<N, D>> knots) : gamma_(gamma), knots_(std::move(knots)) {}
+
+    // REQUIRED: String must be encoded from Encode() function.
+    SplinePLRDataRep(const std::string &encoded_str) {
+        Decode(encoded_str);
+    }
+
+    std::string Encode() const {
+        std::stringstream ss;
+        ss << to_string<D>(gamma_);
+        for (auto &knot: knots_) {
+            ss << to_string<N>(knot.x);
+            ss << to_string<D>(knot.y);
+        }
+        return ss.str();
+    }
+
+    void Decode(const std::string &encoded_str) {
+        size_t ptr = 0;
+        gamma_ = to_type<D>(encoded_str.substr(ptr, sizeof(D)));
+        ptr += sizeof(D);
+        assert((encoded_str.size() - ptr) % sizeof(Knot<N, D>) == 0);
+        knots_.clear();
+        knots_.reserve((encoded_str.size() - ptr) / sizeof(Knot<N, D>));
+        while (ptr < encoded_str.size()) {
+            auto x = to_type<N>(encoded_str.substr(ptr, sizeof(N)));
+            ptr += sizeof(N);
+            auto y = to_type<D>(encoded_str.substr(ptr, sizeof(D)));
+            ptr += sizeof(D);
+            knots_.emplace_back(x, y);
+        }
+    }
+
+    D GetGamma() const {
+        return gamma_;
+    }
+
+    const std::vector<Knot<N, D>> &GetKnots() const {
+        return knots_;
+    }
+
+    // Return the range of the possible block
+    // [lower bound, upper bound] (error-bound included)
+    std::pair<N, N> GetValue(N key) const {
+        if (knots_.empty()) {
+            return std::pair<N, N>();
+        }
+        // The first knot with x > key
+        auto it = std::upper_bound(knots_.begin(), knots_.end(), key,
+                                   [](N k, const Knot<N, D> &knot) { return k < knot.x; });
+        D tar;
+        if (it == knots_.begin()) {
+            tar = it->y;
+        } else if (it == knots_.end()) {
+            tar = knots_.back().y;
+        } else {
+            const Knot<N, D> &left = *(it - 1);
+            D dx = keyOffset<N, D>(key, left.x);
+            tar = left.y + (it->y - left.y) * dx / keyOffset<N, D>(it->x, left.x);
+        }
+        return predictionWindow<N, D>(tar, gamma_);
+    }
+
+private:
+    D gamma_;
+    std::vector<Knot<N, D>> knots_;
+};
+
+#endif //PLR_SPLINE_PLR_H
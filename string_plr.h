@@ -0,0 +1,68 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "library.h"
+
+#ifndef PLR_STRING_PLR_H
+#define PLR_STRING_PLR_H
+
+// PLR training over sorted string keys
+// The longest common prefix of the keys is stripped before the keys are converted to N by stringToNumber(), so
+// all sizeof(N) converted bytes distinguish keys, and it is stored in the model for PLRDataRep::GetValue(key).
+// Keys which are still equal after the conversion cannot be separated by the model, so the model is checked
+// against every key and its gamma is widened to the largest error measured, if that is above the requested gamma.
+template<typename N, typename D>
+class StringKeyPLR {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    StringKeyPLR(D _gamma, GREEDY_PLR_GAP_MODE _gap_mode = GREEDY_PLR_GAP_MODE::CLOSED_FORM,
+                 SEGMENT_ORIGIN _segment_origin = defaultSegmentOrigin<N>(), bool _strip_prefix = true)
+            : gamma(_gamma), gap_mode(_gap_mode), segment_origin(_segment_origin), strip_prefix(_strip_prefix) {}
+
+    // Train over sorted string keys and their positions (or block ids)
+    // REQUIRED: keys are sorted
+    template<typename P>
+    PLRDataRep<N, D> train(const std::string *keys, const P *positions, size_t count) {
+        auto prefix = strip_prefix ? longestCommonPrefix(keys, count) : std::string();
+        auto converted = convert_(keys, count, prefix);
+        auto segments = GreedyPLR<N, D>(gamma, gap_mode, segment_origin).train(converted.data(), positions, count);
+        return model_(std::move(segments), converted, prefix,
+                      [positions](size_t i) { return static_cast<D>(positions[i]); });
+    }
+
+    // Train over sorted string keys, the i-th key has position first_position + i
+    // REQUIRED: keys are sorted
+    PLRDataRep<N, D> train(const std::string *keys, size_t count, D first_position = 0) {
+        auto prefix = strip_prefix ? longestCommonPrefix(keys, count) : std::string();
+        auto converted = convert_(keys, count, prefix);
+        auto segments = GreedyPLR<N, D>(gamma, gap_mode, segment_origin).train(converted.data(), count, first_position);
+        return model_(std::move(segments), converted, prefix,
+                      [first_position](size_t i) { return first_position + static_cast<D>(i); });
+    }
+
+private:
+    D gamma;
+    GREEDY_PLR_GAP_MODE gap_mode;
+    SEGMENT_ORIGIN segment_origin;
+    bool strip_prefix;
+
+    static std::vector<N> convert_(const std::string *keys, size_t count, const std::string &prefix) {
+        std::vector<N> converted(count);
+        for (size_t i = 0; i < count; i++) {
+            converted[i] = stripPrefixToNumber<N>(keys[i], prefix);
+        }
+        return converted;
+    }
+
+    template<typename PositionFn>
+    PLRDataRep<N, D> model_(std::vector<Segment<N, D>> segments, const std::vector<N> &converted,
+                            const std::string &prefix, PositionFn position) const {
+        D max_error = maxSegmentError(segments, segment_origin, converted.data(), converted.size(), position);
+        PLRDataRep<N, D> model(widenedGamma(gamma, max_error), std::move(segments), segment_origin);
+        model.SetKeyPrefix(prefix);
+        return model;
+    }
+};
+
+#endif //PLR_STRING_PLR_H
@@ -0,0 +1,66 @@
+#include <vector>
+#include <algorithm>
+#include "library.h"
+
+#ifndef PLR_TRANSFORMED_PLR_H
+#define PLR_TRANSFORMED_PLR_H
+
+// PLR training in a transformed key space
+// Keys go through a KeyTransform before GreedyPLR, and the trained PLRDataRep applies the same transform in
+// GetValue(). Skewed keys become close to linear in the transformed space, so they need fewer segments.
+// Keys which collide after the transform cannot be separated by the model, so the model is checked against every
+// key and its gamma is widened to the largest error measured, if that is above the requested gamma.
+template<typename N, typename D>
+class TransformedPLR {
+    static_assert(std::is_floating_point<D>(), "Floating point should be placed in second placement,");
+    static_assert(std::is_integral<N>(), "Integer should be placed in first placement.");
+public:
+    TransformedPLR(D _gamma, KeyTransform<N> _transform,
+                   GREEDY_PLR_GAP_MODE _gap_mode = GREEDY_PLR_GAP_MODE::CLOSED_FORM,
+                   SEGMENT_ORIGIN _segment_origin = defaultSegmentOrigin<N>())
+            : gamma(_gamma), transform(std::move(_transform)), gap_mode(_gap_mode), segment_origin(_segment_origin) {}
+
+    // Train over a sorted array of keys and their positions (or block ids)
+    // REQUIRED: keys are sorted
+    template<typename P>
+    PLRDataRep<N, D> train(const N *keys, const P *positions, size_t count) {
+        auto transformed = transform_(keys, count);
+        auto segments = GreedyPLR<N, D>(gamma, gap_mode, segment_origin).train(transformed.data(), positions, count);
+        return model_(std::move(segments), transformed, [positions](size_t i) { return static_cast<D>(positions[i]); });
+    }
+
+    // Train over a sorted array of keys, the i-th key has position first_position + i
+    // REQUIRED: keys are sorted
+    PLRDataRep<N, D> train(const N *keys, size_t count, D first_position = 0) {
+        auto transformed = transform_(keys, count);
+        auto segments = GreedyPLR<N, D>(gamma, gap_mode, segment_origin).train(transformed.data(), count, first_position);
+        return model_(std::move(segments), transformed,
+                      [first_position](size_t i) { return first_position + static_cast<D>(i); });
+    }
+
+private:
+    D gamma;
+    KeyTransform<N> transform;
+    GREEDY_PLR_GAP_MODE gap_mode;
+    SEGMENT_ORIGIN segment_origin;
+
+    std::vector<N> transform_(const N *keys, size_t count) const {
+        std::vector<N> transformed(count);
+        for (size_t i = 0; i < count; i++) {
+            transformed[i] = transform(keys[i]);
+        }
+        return transformed;
+    }
+
+    template<typename PositionFn>
+    PLRDataRep<N, D> model_(std::vector<Segment<N, D>> segments, const std::vector<N> &transformed,
+                            PositionFn position) const {
+        D max_error = maxSegmentError(segments, segment_origin, transformed.data(), transformed.size(), position);
+        D model_gamma = widenedGamma(gamma, max_error);
+        PLRDataRep<N, D> model(model_gamma, std::move(segments), segment_origin);
+        model.SetKeyTransform(transform);
+        return model;
+    }
+};
+
+#endif //PLR_TRANSFORMED_PLR_H